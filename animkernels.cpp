@@ -0,0 +1,241 @@
+#include "animkernels.h"
+#include "animkernels_fp.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace animkernels
+{
+namespace
+{
+// Query CPU features
+void cpuid(int leaf, int subLeaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+    __cpuidex(reinterpret_cast<int *>(regs), leaf, subLeaf);
+#else
+    __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Query registers state enabled by the OS
+unsigned long long xgetbv()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+} // namespace
+
+Isa detectIsa()
+{
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    const unsigned int maxLeaf = regs[0];
+    if (maxLeaf < 7)
+    {
+        return Isa::scalar;
+    }
+
+    // AVX and FMA need to be supported by the CPU, and ymm registers to be
+    // saved by the OS
+    cpuid(1, 0, regs);
+    const bool osxsave = (regs[2] & (1u << 27)) != 0;
+    const bool avx = (regs[2] & (1u << 28)) != 0;
+    const bool fma = (regs[2] & (1u << 12)) != 0;
+    if (!osxsave || !avx || !fma)
+    {
+        return Isa::scalar;
+    }
+    const unsigned long long xcr0 = xgetbv();
+    if ((xcr0 & 0x6) != 0x6)
+    {
+        return Isa::scalar;
+    }
+
+    cpuid(7, 0, regs);
+    const bool avx2 = (regs[1] & (1u << 5)) != 0;
+    // The AVX-512 kernels are compiled with /arch:AVX512, which lets the
+    // compiler use the F, CD, DQ, BW and VL subsets. CPUs like Knights Landing
+    // only have some of them
+    const unsigned int avx512Bits = (1u << 16) | (1u << 17) | (1u << 28) |
+                                    (1u << 30) | (1u << 31);
+    const bool avx512 = (regs[1] & avx512Bits) == avx512Bits;
+
+    // AVX-512 also needs opmask and zmm registers to be saved by the OS
+    if (avx2 && avx512 && ((xcr0 & 0xe6) == 0xe6))
+    {
+        return Isa::avx512;
+    }
+    return avx2 ? Isa::avx2 : Isa::scalar;
+}
+
+bool isSupported(Isa isa)
+{
+    static const Isa best = detectIsa();
+    return int(isa) <= int(best);
+}
+
+const char *isaName(Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::avx2:
+        return "AVX2";
+    case Isa::avx512:
+        return "AVX-512";
+    default:
+        return "scalar";
+    }
+}
+
+float fastSin(float x)
+{
+    const float pi = 3.14159265f;
+    const float halfPi = 1.57079633f;
+    const float twoPi = 6.28318531f;
+    const float invTwoPi = 0.159154943f;
+
+    // Reduce to [-pi, pi] then fold to [-pi/2, pi/2]
+    x = x - twoPi * std::nearbyint(x * invTwoPi);
+    float ax = std::fabs(x);
+    ax = (ax > halfPi) ? pi - ax : ax;
+    x = std::copysign(ax, x);
+
+    // Minimax polynomial, error is below 6e-7
+    const float x2 = x * x;
+    float p = 2.60831598e-6f;
+    p = p * x2 - 0.000198089279f;
+    p = p * x2 + 0.00833307858f;
+    p = p * x2 - 0.166666597f;
+    p = p * x2 + 1.f;
+    return p * x;
+}
+
+bool playback(Isa isa, const PlaybackArgs &args, size_t begin, size_t end)
+{
+    switch (isa)
+    {
+    case Isa::avx512:
+        return avx512::playback(args, begin, end);
+    case Isa::avx2:
+        return avx2::playback(args, begin, end);
+    default:
+        return scalar::playback(args, begin, end);
+    }
+}
+
+bool wave(Isa isa, const WaveArgs &args, size_t begin, size_t end)
+{
+    switch (isa)
+    {
+    case Isa::avx512:
+        return avx512::wave(args, begin, end);
+    case Isa::avx2:
+        return avx2::wave(args, begin, end);
+    default:
+        return scalar::wave(args, begin, end);
+    }
+}
+
+bool fadeOut(Isa isa, const FadeOutArgs &args, size_t begin, size_t end)
+{
+    switch (isa)
+    {
+    case Isa::avx512:
+        return avx512::fadeOut(args, begin, end);
+    case Isa::avx2:
+        return avx2::fadeOut(args, begin, end);
+    default:
+        return scalar::fadeOut(args, begin, end);
+    }
+}
+
+namespace scalar
+{
+bool playback(const PlaybackArgs &args, size_t begin, size_t end)
+{
+    const float g = 9.81f;
+    for (size_t i = begin; i < end; ++i)
+    {
+        const float T = args.bouncePeriod[i];
+        const float Vmax = args.bounceSpeed[i];
+        const float tRemainder = std::fmodf(0.5f * T + args.t, T);
+
+        float *center = &args.geometry[4 * i];
+        const float *endPos = &args.endPos[3 * i];
+        const float *velocity = &args.velocity[2 * i];
+
+        center[1] = -1.f + args.refRadius[i] -
+                    0.5f * g * tRemainder * tRemainder + Vmax * tRemainder;
+
+        // Add some side movements, one step at a time like the animation was
+        // baked, so positions are bit-identical to the baked ones
+        const float dx = args.deltaTime * velocity[0];
+        const float dz = args.deltaTime * velocity[1];
+        float x = endPos[0];
+        float z = endPos[2];
+        for (int step = 0; step < args.steps; ++step)
+        {
+            x += dx;
+            z += dz;
+        }
+        center[0] = x;
+        center[2] = z;
+    }
+    return end > begin;
+}
+
+bool wave(const WaveArgs &args, size_t begin, size_t end)
+{
+    bool updated = false;
+    for (size_t i = begin; i < end; ++i)
+    {
+        const float dx = (args.endPos[3 * i] - args.x0) / (args.x1 - args.x0);
+        float tWave = args.tRel * args.waveSpeed - dx;
+
+        if ((tWave >= 0.f) && (tWave <= args.waveWidth))
+        {
+            tWave /= args.waveWidth;
+            const float wave =
+                1.f + fastSin(float(std::_Pi) * (2 * tWave - 0.5f));
+            args.geometry[4 * i + 2] =
+                args.endPos[3 * i + 2] + args.waveStrength * wave;
+
+            const float a = std::max(0.f, (tWave < 0.5f ? tWave : 1.f - tWave));
+            args.geometry[4 * i + 3] =
+                args.refRadius[i] * (1.f + args.scaleFactor * a);
+
+            updated = true;
+        }
+    }
+    return updated;
+}
+
+bool fadeOut(const FadeOutArgs &args, size_t begin, size_t end)
+{
+    bool updated = false;
+    for (size_t i = begin; i < end; ++i)
+    {
+        const float scale =
+            std::max(0.f, 1.f - args.tRel / args.fadeOffDuration[i]);
+        args.geometry[4 * i + 3] = args.refRadius[i] * scale;
+        if (scale > 0.f)
+        {
+            updated = true;
+        }
+    }
+    return updated;
+}
+} // namespace scalar
+} // namespace animkernels
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+
+// Kernels for the per-sphere loops of the animation phases.
+// They work on raw float arrays so they can be compiled for different
+// instruction sets: sphere geometry is packed as (x, y, z, radius), end
+// positions as (x, y, z) and velocities as (x, z).
+// The scalar kernels are the reference implementation. Vector kernels do the
+// same operations in the same order, so every instruction set animates the
+// spheres exactly the same way.
+namespace animkernels
+{
+// Instruction sets the kernels are available for
+enum class Isa
+{
+    scalar,
+    avx2,
+    avx512,
+};
+
+// Best instruction set supported by the CPU and the OS
+Isa detectIsa();
+// Check if the instruction set can be used on this machine
+bool isSupported(Isa isa);
+// Readable name of the instruction set
+const char *isaName(Isa isa);
+
+// Fast sine approximation, used by all the kernels. Absolute error is below
+// 6e-7 for |x| <= 4 pi, it grows with |x| past that since 2 pi is rounded
+float fastSin(float x);
+
+struct PlaybackArgs
+{
+    float *geometry;
+    const float *endPos;
+    const float *velocity;
+    const float *refRadius;
+    const float *bouncePeriod;
+    const float *bounceSpeed;
+    float t;         // Bounce time of the current frame
+    int steps;       // Number of side movement steps of the current frame
+    float deltaTime; // Duration of a side movement step
+};
+
+struct WaveArgs
+{
+    float *geometry;
+    const float *endPos;
+    const float *refRadius;
+    float tRel;         // Time since the beginning of the wave
+    float x0, x1;       // Extent of the wave along x
+    float waveWidth;    // Width of the wave, relative to the x extent
+    float waveStrength; // Amplitude of the wave along z
+    float waveSpeed;    // Speed of the wave, relative to the x extent
+    float scaleFactor;  // Maximum scaling of the spheres under the wave
+};
+
+struct FadeOutArgs
+{
+    float *geometry;
+    const float *refRadius;
+    const float *fadeOffDuration;
+    float tRel; // Time since the beginning of the fade out
+};
+
+// Animate spheres in [begin, end[ with the given instruction set, the
+// returned value tells if any of these spheres was updated
+bool playback(Isa isa, const PlaybackArgs &args, size_t begin, size_t end);
+bool wave(Isa isa, const WaveArgs &args, size_t begin, size_t end);
+bool fadeOut(Isa isa, const FadeOutArgs &args, size_t begin, size_t end);
+
+// Implementations for each instruction set, each one lives in its own
+// translation unit compiled for that instruction set
+#define ANIMKERNELS_DECLARE(ISA)                                               \
+    namespace ISA                                                              \
+    {                                                                          \
+    bool playback(const PlaybackArgs &args, size_t begin, size_t end);         \
+    bool wave(const WaveArgs &args, size_t begin, size_t end);                 \
+    bool fadeOut(const FadeOutArgs &args, size_t begin, size_t end);           \
+    }
+
+ANIMKERNELS_DECLARE(scalar)
+ANIMKERNELS_DECLARE(avx2)
+ANIMKERNELS_DECLARE(avx512)
+
+#undef ANIMKERNELS_DECLARE
+} // namespace animkernels
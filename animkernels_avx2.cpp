@@ -0,0 +1,155 @@
+// Animation kernels for AVX2, this file must be compiled with AVX2 and FMA
+// enabled (/arch:AVX2)
+
+#include "animkernels_simd.h"
+
+#include <immintrin.h>
+
+namespace animkernels
+{
+namespace
+{
+struct Avx2
+{
+    static constexpr size_t width = 8;
+    using vfloat = __m256;
+    using vmask = __m256;
+
+    static vfloat set1(float f) { return _mm256_set1_ps(f); }
+    static vfloat load(const float *p) { return _mm256_loadu_ps(p); }
+
+    // Load member `offset` of `width` consecutive items of `stride` floats
+    static vfloat gather(const float *p, size_t first, int stride, int offset)
+    {
+        const __m256i index =
+            _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                               _mm256_set1_epi32(stride));
+        return _mm256_i32gather_ps(p + first * stride + offset, index, 4);
+    }
+
+    // Load and store packed (x, y, z, radius) spheres, using 8x4 transposes
+    static void loadGeometry(const float *p, vfloat &x, vfloat &y, vfloat &z,
+                             vfloat &r)
+    {
+        const __m256 m0 = _mm256_loadu_ps(p);
+        const __m256 m1 = _mm256_loadu_ps(p + 8);
+        const __m256 m2 = _mm256_loadu_ps(p + 16);
+        const __m256 m3 = _mm256_loadu_ps(p + 24);
+        const __m256 a0 = _mm256_permute2f128_ps(m0, m2, 0x20);
+        const __m256 a1 = _mm256_permute2f128_ps(m0, m2, 0x31);
+        const __m256 a2 = _mm256_permute2f128_ps(m1, m3, 0x20);
+        const __m256 a3 = _mm256_permute2f128_ps(m1, m3, 0x31);
+        const __m256 t0 = _mm256_unpacklo_ps(a0, a1);
+        const __m256 t1 = _mm256_unpackhi_ps(a0, a1);
+        const __m256 t2 = _mm256_unpacklo_ps(a2, a3);
+        const __m256 t3 = _mm256_unpackhi_ps(a2, a3);
+        x = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        y = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        z = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        r = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    }
+
+    static void storeGeometry(float *p, vfloat x, vfloat y, vfloat z, vfloat r)
+    {
+        const __m256 t0 = _mm256_unpacklo_ps(x, y);
+        const __m256 t1 = _mm256_unpackhi_ps(x, y);
+        const __m256 t2 = _mm256_unpacklo_ps(z, r);
+        const __m256 t3 = _mm256_unpackhi_ps(z, r);
+        const __m256 a0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 a1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 a2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 a3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        _mm256_storeu_ps(p, _mm256_permute2f128_ps(a0, a1, 0x20));
+        _mm256_storeu_ps(p + 8, _mm256_permute2f128_ps(a2, a3, 0x20));
+        _mm256_storeu_ps(p + 16, _mm256_permute2f128_ps(a0, a1, 0x31));
+        _mm256_storeu_ps(p + 24, _mm256_permute2f128_ps(a2, a3, 0x31));
+    }
+
+    static void storeZRadius(float *p, vmask m, vfloat z, vfloat r)
+    {
+        vfloat x, y, oldZ, oldR;
+        loadGeometry(p, x, y, oldZ, oldR);
+        storeGeometry(p, x, y, select(m, z, oldZ), select(m, r, oldR));
+    }
+
+    static void storeRadius(float *p, vfloat r)
+    {
+        vfloat x, y, z, oldR;
+        loadGeometry(p, x, y, z, oldR);
+        storeGeometry(p, x, y, z, r);
+    }
+
+    static vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+    static vfloat sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+    static vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+    static vfloat div(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+    static vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+    // c - a * b
+    static vfloat fnmadd(vfloat a, vfloat b, vfloat c)
+    {
+        return _mm256_fnmadd_ps(a, b, c);
+    }
+    static vfloat floor(vfloat a) { return _mm256_floor_ps(a); }
+    static vfloat round(vfloat a)
+    {
+        return _mm256_round_ps(a,
+                               _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    }
+
+    static vfloat abs(vfloat a)
+    {
+        return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a);
+    }
+    static vfloat signBits(vfloat a)
+    {
+        return _mm256_and_ps(_mm256_set1_ps(-0.f), a);
+    }
+    static vfloat xorBits(vfloat a, vfloat b) { return _mm256_xor_ps(a, b); }
+
+    static vmask cmplt(vfloat a, vfloat b)
+    {
+        return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+    }
+    static vmask cmple(vfloat a, vfloat b)
+    {
+        return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+    }
+    static vmask cmpgt(vfloat a, vfloat b)
+    {
+        return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+    }
+    static vmask cmpge(vfloat a, vfloat b)
+    {
+        return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+    }
+    static vmask andMask(vmask a, vmask b) { return _mm256_and_ps(a, b); }
+    static bool any(vmask m) { return _mm256_movemask_ps(m) != 0; }
+    // m ? a : b
+    static vfloat select(vmask m, vfloat a, vfloat b)
+    {
+        return _mm256_blendv_ps(b, a, m);
+    }
+};
+} // namespace
+} // namespace animkernels
+
+namespace animkernels
+{
+namespace avx2
+{
+bool playback(const PlaybackArgs &args, size_t begin, size_t end)
+{
+    return playbackKernel<Avx2>(args, begin, end);
+}
+
+bool wave(const WaveArgs &args, size_t begin, size_t end)
+{
+    return waveKernel<Avx2>(args, begin, end);
+}
+
+bool fadeOut(const FadeOutArgs &args, size_t begin, size_t end)
+{
+    return fadeOutKernel<Avx2>(args, begin, end);
+}
+} // namespace avx2
+} // namespace animkernels
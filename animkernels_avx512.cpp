@@ -0,0 +1,135 @@
+// Animation kernels for AVX-512, this file must be compiled with AVX-512
+// enabled (/arch:AVX512)
+
+#include "animkernels_simd.h"
+
+#include <immintrin.h>
+
+namespace animkernels
+{
+namespace
+{
+struct Avx512
+{
+    static constexpr size_t width = 16;
+    using vfloat = __m512;
+    using vmask = __mmask16;
+
+    static vfloat set1(float f) { return _mm512_set1_ps(f); }
+    static vfloat load(const float *p) { return _mm512_loadu_ps(p); }
+
+    static __m512i strideIndex(int stride)
+    {
+        return _mm512_mullo_epi32(
+            _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                              15),
+            _mm512_set1_epi32(stride));
+    }
+
+    // Load member `offset` of `width` consecutive items of `stride` floats
+    static vfloat gather(const float *p, size_t first, int stride, int offset)
+    {
+        return _mm512_i32gather_ps(strideIndex(stride),
+                                   p + first * stride + offset, 4);
+    }
+
+    // Store packed (x, y, z, radius) spheres using scatters
+    static void storeGeometry(float *p, vfloat x, vfloat y, vfloat z, vfloat r)
+    {
+        const __m512i index = strideIndex(4);
+        _mm512_i32scatter_ps(p, index, x, 4);
+        _mm512_i32scatter_ps(p + 1, index, y, 4);
+        _mm512_i32scatter_ps(p + 2, index, z, 4);
+        _mm512_i32scatter_ps(p + 3, index, r, 4);
+    }
+
+    static void storeZRadius(float *p, vmask m, vfloat z, vfloat r)
+    {
+        const __m512i index = strideIndex(4);
+        _mm512_mask_i32scatter_ps(p + 2, m, index, z, 4);
+        _mm512_mask_i32scatter_ps(p + 3, m, index, r, 4);
+    }
+
+    static void storeRadius(float *p, vfloat r)
+    {
+        _mm512_i32scatter_ps(p + 3, strideIndex(4), r, 4);
+    }
+
+    static vfloat add(vfloat a, vfloat b) { return _mm512_add_ps(a, b); }
+    static vfloat sub(vfloat a, vfloat b) { return _mm512_sub_ps(a, b); }
+    static vfloat mul(vfloat a, vfloat b) { return _mm512_mul_ps(a, b); }
+    static vfloat div(vfloat a, vfloat b) { return _mm512_div_ps(a, b); }
+    static vfloat max(vfloat a, vfloat b) { return _mm512_max_ps(a, b); }
+    // c - a * b
+    static vfloat fnmadd(vfloat a, vfloat b, vfloat c)
+    {
+        return _mm512_fnmadd_ps(a, b, c);
+    }
+    static vfloat floor(vfloat a)
+    {
+        return _mm512_roundscale_ps(a,
+                                    _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    }
+    static vfloat round(vfloat a)
+    {
+        return _mm512_roundscale_ps(
+            a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    }
+
+    static vfloat abs(vfloat a)
+    {
+        return _mm512_andnot_ps(_mm512_set1_ps(-0.f), a);
+    }
+    static vfloat signBits(vfloat a)
+    {
+        return _mm512_and_ps(_mm512_set1_ps(-0.f), a);
+    }
+    static vfloat xorBits(vfloat a, vfloat b) { return _mm512_xor_ps(a, b); }
+
+    static vmask cmplt(vfloat a, vfloat b)
+    {
+        return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);
+    }
+    static vmask cmple(vfloat a, vfloat b)
+    {
+        return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ);
+    }
+    static vmask cmpgt(vfloat a, vfloat b)
+    {
+        return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);
+    }
+    static vmask cmpge(vfloat a, vfloat b)
+    {
+        return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ);
+    }
+    static vmask andMask(vmask a, vmask b) { return vmask(a & b); }
+    static bool any(vmask m) { return m != 0; }
+    // m ? a : b
+    static vfloat select(vmask m, vfloat a, vfloat b)
+    {
+        return _mm512_mask_blend_ps(m, b, a);
+    }
+};
+} // namespace
+} // namespace animkernels
+
+namespace animkernels
+{
+namespace avx512
+{
+bool playback(const PlaybackArgs &args, size_t begin, size_t end)
+{
+    return playbackKernel<Avx512>(args, begin, end);
+}
+
+bool wave(const WaveArgs &args, size_t begin, size_t end)
+{
+    return waveKernel<Avx512>(args, begin, end);
+}
+
+bool fadeOut(const FadeOutArgs &args, size_t begin, size_t end)
+{
+    return fadeOutKernel<Avx512>(args, begin, end);
+}
+} // namespace avx512
+} // namespace animkernels
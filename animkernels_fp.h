@@ -0,0 +1,15 @@
+#pragma once
+
+// Floating point settings of the animation kernels. Each of their translation
+// units includes this header before any of its code.
+// Multiplies and adds must not be fused into FMAs, which round differently:
+// every instruction set must animate the spheres bit for bit like the scalar
+// kernels, and play back the exact positions of the original animation
+
+#if defined(_MSC_VER)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
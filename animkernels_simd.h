@@ -0,0 +1,159 @@
+#pragma once
+
+// Vector kernels shared by all the instruction sets.
+// This header is only included by the translation units compiled for a given
+// instruction set, first, then they define a backend V providing the vector
+// operations. Everything lives in an anonymous namespace so code compiled for
+// different instruction sets never gets mixed up by the linker.
+
+#include "animkernels_fp.h"
+
+#include "animkernels.h"
+
+namespace animkernels
+{
+namespace
+{
+// Fast sine approximation, see the scalar version for details
+template <typename V>
+typename V::vfloat fastSin(typename V::vfloat x)
+{
+    const auto pi = V::set1(3.14159265f);
+    const auto halfPi = V::set1(1.57079633f);
+    const auto twoPi = V::set1(6.28318531f);
+    const auto invTwoPi = V::set1(0.159154943f);
+
+    // Reduce to [-pi, pi] then fold to [-pi/2, pi/2]
+    x = V::sub(x, V::mul(twoPi, V::round(V::mul(x, invTwoPi))));
+    const auto sign = V::signBits(x);
+    auto ax = V::abs(x);
+    ax = V::select(V::cmpgt(ax, halfPi), V::sub(pi, ax), ax);
+    x = V::xorBits(ax, sign);
+
+    // Minimax polynomial
+    const auto x2 = V::mul(x, x);
+    auto p = V::set1(2.60831598e-6f);
+    p = V::add(V::mul(p, x2), V::set1(-0.000198089279f));
+    p = V::add(V::mul(p, x2), V::set1(0.00833307858f));
+    p = V::add(V::mul(p, x2), V::set1(-0.166666597f));
+    p = V::add(V::mul(p, x2), V::set1(1.f));
+    return V::mul(p, x);
+}
+
+template <typename V>
+bool playbackKernel(const PlaybackArgs &args, size_t begin, size_t end)
+{
+    const auto t = V::set1(args.t);
+    const auto deltaTime = V::set1(args.deltaTime);
+    const auto zero = V::set1(0.f);
+    const auto half = V::set1(0.5f);
+    const auto halfG = V::set1(0.5f * 9.81f);
+    const auto minusOne = V::set1(-1.f);
+
+    size_t i = begin;
+    for (; i + V::width <= end; i += V::width)
+    {
+        const auto T = V::load(args.bouncePeriod + i);
+        const auto Vmax = V::load(args.bounceSpeed + i);
+        const auto radius = V::load(args.refRadius + i);
+
+        // Floating point modulo: the remainder is exact as long as the
+        // quotient is, fix it up when the division rounded up
+        const auto a = V::add(V::mul(half, T), t);
+        auto tRemainder = V::fnmadd(V::floor(V::div(a, T)), T, a);
+        tRemainder = V::select(V::cmplt(tRemainder, zero),
+                               V::add(tRemainder, T), tRemainder);
+
+        const auto y =
+            V::add(V::sub(V::add(minusOne, radius),
+                          V::mul(V::mul(halfG, tRemainder), tRemainder)),
+                   V::mul(Vmax, tRemainder));
+
+        // Add some side movements, step by step like the scalar kernel
+        const auto dx = V::mul(deltaTime, V::gather(args.velocity, i, 2, 0));
+        const auto dz = V::mul(deltaTime, V::gather(args.velocity, i, 2, 1));
+        auto x = V::gather(args.endPos, i, 3, 0);
+        auto z = V::gather(args.endPos, i, 3, 2);
+        for (int step = 0; step < args.steps; ++step)
+        {
+            x = V::add(x, dx);
+            z = V::add(z, dz);
+        }
+
+        V::storeGeometry(args.geometry + 4 * i, x, y, z, radius);
+    }
+
+    scalar::playback(args, i, end);
+    return end > begin;
+}
+
+template <typename V>
+bool waveKernel(const WaveArgs &args, size_t begin, size_t end)
+{
+    const auto x0 = V::set1(args.x0);
+    const auto xRange = V::set1(args.x1 - args.x0);
+    const auto tRelSpeed = V::set1(args.tRel * args.waveSpeed);
+    const auto waveWidth = V::set1(args.waveWidth);
+    const auto waveStrength = V::set1(args.waveStrength);
+    const auto scaleFactor = V::set1(args.scaleFactor);
+    const auto zero = V::set1(0.f);
+    const auto half = V::set1(0.5f);
+    const auto one = V::set1(1.f);
+    const auto two = V::set1(2.f);
+    const auto pi = V::set1(3.14159265f);
+
+    bool updated = false;
+    size_t i = begin;
+    for (; i + V::width <= end; i += V::width)
+    {
+        const auto dx =
+            V::div(V::sub(V::gather(args.endPos, i, 3, 0), x0), xRange);
+        auto tWave = V::sub(tRelSpeed, dx);
+
+        const auto inWave =
+            V::andMask(V::cmpge(tWave, zero), V::cmple(tWave, waveWidth));
+        if (!V::any(inWave))
+        {
+            continue;
+        }
+
+        tWave = V::div(tWave, waveWidth);
+        const auto wave = V::add(
+            one, fastSin<V>(V::mul(pi, V::sub(V::mul(two, tWave), half))));
+        const auto z =
+            V::add(V::gather(args.endPos, i, 3, 2), V::mul(waveStrength, wave));
+
+        const auto a = V::max(zero, V::select(V::cmplt(tWave, half), tWave,
+                                              V::sub(one, tWave)));
+        const auto radius = V::mul(V::load(args.refRadius + i),
+                                   V::add(one, V::mul(scaleFactor, a)));
+
+        V::storeZRadius(args.geometry + 4 * i, inWave, z, radius);
+        updated = true;
+    }
+
+    return scalar::wave(args, i, end) || updated;
+}
+
+template <typename V>
+bool fadeOutKernel(const FadeOutArgs &args, size_t begin, size_t end)
+{
+    const auto tRel = V::set1(args.tRel);
+    const auto zero = V::set1(0.f);
+    const auto one = V::set1(1.f);
+
+    bool updated = false;
+    size_t i = begin;
+    for (; i + V::width <= end; i += V::width)
+    {
+        const auto scale = V::max(
+            zero, V::sub(one, V::div(tRel, V::load(args.fadeOffDuration + i))));
+        V::storeRadius(args.geometry + 4 * i,
+                       V::mul(V::load(args.refRadius + i), scale));
+        updated = updated || V::any(V::cmpgt(scale, zero));
+    }
+
+    return scalar::fadeOut(args, i, end) || updated;
+}
+} // namespace
+} // namespace animkernels
@@ -0,0 +1,465 @@
+// Benchmarks of the hot paths of the animation and of writing frames.
+// OSPRay runs on its default device, which renders on the CPU without any
+// window. Results are stable enough to be compared between releases with
+//   benchmarks --benchmark_repetitions=5 --benchmark_out=results.json
+// and Google Benchmark's tools/compare.py
+
+#include <benchmark/benchmark.h>
+
+#include <bitset>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../animkernels.h"
+#include "../fonts.h"
+#include "../scene.h"
+#include "../utils.h"
+
+// Steps of the scene, which are private
+class SceneBenchmark
+{
+public:
+    // Keep the spheres of a scene aside, so it can generate others while
+    // OSPRay still shares the original ones. They are restored when destroyed
+    class SpheresAside
+    {
+    public:
+        explicit SpheresAside(Scene &scene)
+            : _scene(scene)
+        {
+            std::swap(_scene._spheres, _spheres);
+        }
+        ~SpheresAside() { std::swap(_scene._spheres, _spheres); }
+
+    private:
+        Scene &_scene;
+        Scene::Spheres _spheres;
+    };
+
+    static void clearSpheres(Scene &scene) { scene._spheres = {}; }
+    static void generateSpheres(Scene &scene, const std::string &text)
+    {
+        scene.generateSpheres(text);
+    }
+    static void computeAnimations(Scene &scene) { scene.computeAnimations(); }
+
+    // Play the next frame without committing it
+    static bool animate(Scene &scene)
+    {
+        return scene._animState(scene._spheres);
+    }
+
+    // Commit the changes of the last frame again
+    static void commit(Scene &scene)
+    {
+        scene.updateSpheresGeometry();
+        scene._commits->markDirty(scene._world.get(),
+                                  CommitScheduler::Stage::world);
+        scene._commits->flush();
+    }
+
+    // OSPRay objects committed by the last commit
+    static size_t getNumCommits(const Scene &scene)
+    {
+        return scene._commits->getNumCommits();
+    }
+
+    // OSPRay objects created by the scene so far
+    static size_t getNumCreated(const Scene &scene)
+    {
+        return scene._pool.getNumCreated();
+    }
+
+    // Check that each kernel supported by the CPU plays the same playback
+    // frames, bit for bit, as the animation baked by the original code
+    static bool checkPlayback(Scene &scene)
+    {
+        const Scene::Spheres &spheres = scene._spheres;
+        const size_t numSpheres = spheres.size();
+        const int numFrames = Scene::_numPlaybackFrames;
+        const float deltaTime = scene._deltaTime;
+        const float g = 9.81f;
+
+        // Bake positions like the original computeAnimations
+        std::vector<ospcommon::vec3f> positions(numFrames * numSpheres);
+        for (size_t i = 0; i < numSpheres; ++i)
+        {
+            float t = 0;
+            ospcommon::vec3f pos = spheres.endPos[i];
+            for (int frame = numFrames - 1; frame >= 0; --frame)
+            {
+                const float maxHeight = 1 + spheres.maxHeight[i];
+                const float T = sqrtf(8.f * maxHeight / g);
+                const float Vmax = sqrtf(2.f * maxHeight * g);
+                const float tRemainder = std::fmodf(0.5f * T + t, T);
+
+                pos.y = -1.f + spheres.refRadius[i] -
+                        0.5f * g * tRemainder * tRemainder + Vmax * tRemainder;
+                pos.x += deltaTime * spheres.velocity[i].x;
+                pos.z += deltaTime * spheres.velocity[i].y;
+
+                positions[frame * numSpheres + i] = pos;
+                t += deltaTime;
+            }
+        }
+
+        const animkernels::Isa isas[] = {animkernels::Isa::scalar,
+                                         animkernels::Isa::avx2,
+                                         animkernels::Isa::avx512};
+        const animkernels::Isa previousIsa = scene.getKernelsIsa();
+        bool identical = true;
+        for (const animkernels::Isa isa : isas)
+        {
+            if (!animkernels::isSupported(isa))
+            {
+                continue;
+            }
+            scene.setKernelsIsa(isa);
+            scene._animState.seek(scene._spheres, -1);
+            size_t i = numSpheres;
+            int frame = 0;
+            for (; (frame < numFrames) && (i == numSpheres); ++frame)
+            {
+                scene._animState(scene._spheres);
+                const ospcommon::vec3f *expected =
+                    &positions[frame * numSpheres];
+                for (i = 0; i < numSpheres; ++i)
+                {
+                    const ospcommon::vec3f &center = spheres.geometry[i].center;
+                    if (std::memcmp(&center, &expected[i], sizeof(center)) != 0)
+                    {
+                        break;
+                    }
+                }
+            }
+            if (i != numSpheres)
+            {
+                fprintf(stderr,
+                        "%s playback differs from the baked animation at "
+                        "frame %d, sphere %zu\n",
+                        animkernels::isaName(isa), frame - 1, i);
+                identical = false;
+            }
+        }
+        scene.setKernelsIsa(previousIsa);
+        return identical;
+    }
+
+    // Check that each kernel supported by the CPU plays the whole animation
+    // bit for bit like the scalar ones, so frames don't depend on the CPU
+    static bool checkKernels(Scene &scene)
+    {
+        const Scene::Spheres &spheres = scene._spheres;
+        const size_t frameSize = spheres.size() * sizeof(Scene::SphereGeometry);
+        const animkernels::Isa previousIsa = scene.getKernelsIsa();
+
+        // Spheres of each frame, with the scalar kernels
+        std::vector<char> reference;
+        scene.setKernelsIsa(animkernels::Isa::scalar);
+        scene._animState.seek(scene._spheres, -1);
+        while (scene._animState(scene._spheres))
+        {
+            const char *geometry =
+                reinterpret_cast<const char *>(spheres.geometry.data());
+            reference.insert(reference.end(), geometry, geometry + frameSize);
+        }
+
+        const animkernels::Isa isas[] = {animkernels::Isa::avx2,
+                                         animkernels::Isa::avx512};
+        bool identical = true;
+        for (const animkernels::Isa isa : isas)
+        {
+            if (!animkernels::isSupported(isa))
+            {
+                continue;
+            }
+            scene.setKernelsIsa(isa);
+            scene._animState.seek(scene._spheres, -1);
+            size_t offset = 0;
+            while (scene._animState(scene._spheres))
+            {
+                if ((offset + frameSize > reference.size()) ||
+                    (std::memcmp(spheres.geometry.data(), &reference[offset],
+                                 frameSize) != 0))
+                {
+                    fprintf(stderr,
+                            "%s kernels differ from the scalar ones at frame "
+                            "%d\n",
+                            animkernels::isaName(isa),
+                            scene._animState.getFrame());
+                    identical = false;
+                    break;
+                }
+                offset += frameSize;
+            }
+        }
+        scene.setKernelsIsa(previousIsa);
+        return identical;
+    }
+};
+
+namespace
+{
+// Sphere counts of the scene benchmarks, from a few thousand to a few million
+const int64_t sphereCounts[] = {int64_t(1) << 12, int64_t(1) << 16,
+                                int64_t(1) << 20, int64_t(1) << 22};
+
+// Text drawn by at least the given number of spheres, repeating words on
+// lines of the same length
+std::string makeText(int64_t numSpheres)
+{
+    const std::string words = "The Blue Brain Project is mindblowing! ";
+    const int lettersPerLine = 64;
+
+    std::string text;
+    int64_t numPixels = 0;
+    for (size_t i = 0; numPixels < numSpheres; ++i)
+    {
+        const char letter = words[i % words.size()];
+        for (int line = 0; line < fonts::lettersHeight; ++line)
+        {
+            numPixels +=
+                std::bitset<8>(fonts::getLetterScanLine(letter, line)).count();
+        }
+        text += letter;
+        if ((i + 1) % lettersPerLine == 0)
+        {
+            text += '\n';
+        }
+    }
+    return text;
+}
+
+// Scenes with millions of spheres are slow to create, the last one is reused
+// by the following benchmarks. They run by number of spheres, so each scene
+// is only created once
+std::unique_ptr<Scene> cachedScene;
+int64_t cachedSpheres = 0;
+
+Scene &getScene(int64_t numSpheres)
+{
+    if (!cachedScene || (cachedSpheres != numSpheres))
+    {
+        cachedScene.reset();
+        cachedScene.reset(new Scene(0, makeText(numSpheres)));
+        cachedSpheres = numSpheres;
+    }
+    return *cachedScene;
+}
+
+void renderText(benchmark::State &state)
+{
+    const std::string text = makeText(state.range(0));
+    int64_t numPixels = 0;
+    for (auto _ : state)
+    {
+        fonts::renderText(text, [&](float x, float y) {
+            benchmark::DoNotOptimize(x);
+            benchmark::DoNotOptimize(y);
+            ++numPixels;
+        });
+    }
+    state.SetItemsProcessed(numPixels);
+}
+
+void generateSpheres(benchmark::State &state)
+{
+    Scene &scene = getScene(state.range(0));
+    const std::string text = makeText(state.range(0));
+    SceneBenchmark::SpheresAside aside(scene);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        SceneBenchmark::clearSpheres(scene);
+        state.ResumeTiming();
+        SceneBenchmark::generateSpheres(scene, text);
+    }
+    state.SetItemsProcessed(state.iterations() * scene.getNumSpheres());
+}
+
+void computeAnimations(benchmark::State &state)
+{
+    Scene &scene = getScene(state.range(0));
+    for (auto _ : state)
+    {
+        SceneBenchmark::computeAnimations(scene);
+    }
+    state.SetItemsProcessed(state.iterations() * scene.getNumSpheres());
+}
+
+// Frame in the middle of a phase, some spheres only move during part of it
+int getMiddleFrame(const Scene &scene, Scene::AnimPhase phase)
+{
+    return (scene.getPhaseStart(phase) +
+            scene.getPhaseStart(Scene::AnimPhase(int(phase) + 1))) /
+           2;
+}
+
+// Play the frames of a phase, going back to its start once it is over
+void animate(benchmark::State &state, Scene::AnimPhase phase)
+{
+    Scene &scene = getScene(state.range(0));
+    const int first = scene.getPhaseStart(phase);
+    const int last = scene.getPhaseStart(Scene::AnimPhase(int(phase) + 1)) - 1;
+    scene.evaluateAt(first);
+    for (auto _ : state)
+    {
+        if (scene.getFrame() >= last)
+        {
+            state.PauseTiming();
+            scene.evaluateAt(first);
+            state.ResumeTiming();
+        }
+        SceneBenchmark::animate(scene);
+    }
+    state.SetItemsProcessed(state.iterations() * scene.getNumSpheres());
+}
+
+// Commit the changes of a frame in the middle of a phase. It is played
+// rather than evaluated, which changes all the spheres. Also counts the OSPRay
+// objects committed and created by each commit
+void commit(benchmark::State &state, Scene::AnimPhase phase)
+{
+    Scene &scene = getScene(state.range(0));
+    scene.evaluateAt(getMiddleFrame(scene, phase) - 1);
+    scene.tick();
+    const size_t numCreated = SceneBenchmark::getNumCreated(scene);
+    for (auto _ : state)
+    {
+        SceneBenchmark::commit(scene);
+    }
+    state.counters["dirty"] = double(scene.getNumDirtySpheres());
+    state.counters["commits"] = double(SceneBenchmark::getNumCommits(scene));
+    state.counters["objects"] = benchmark::Counter(
+        double(SceneBenchmark::getNumCreated(scene) - numCreated),
+        benchmark::Counter::kAvgIterations);
+}
+
+void hsl2RGB(benchmark::State &state)
+{
+    const int numColors = 4096;
+    for (auto _ : state)
+    {
+        for (int i = 0; i < numColors; ++i)
+        {
+            benchmark::DoNotOptimize(
+                utils::hsl2RGB(360.f * i / numColors, 1.f, 0.5f));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * numColors);
+}
+
+void writePPM(benchmark::State &state)
+{
+    const ospcommon::vec2i size{int(state.range(0)), int(state.range(1))};
+    std::vector<uint32_t> pixels(size_t(size.x) * size.y);
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+        pixels[i] = uint32_t(i * 2654435761u) | 0xff000000u;
+    }
+
+    const char *fileName = "benchmark.ppm";
+    for (auto _ : state)
+    {
+        if (!utils::writePPM(fileName, size, pixels.data()))
+        {
+            state.SkipWithError("writePPM failed");
+            break;
+        }
+    }
+    std::remove(fileName);
+    state.SetBytesProcessed(state.iterations() * int64_t(pixels.size()) * 3);
+}
+
+void registerBenchmarks()
+{
+    const Scene::AnimPhase phases[] = {
+        Scene::AnimPhase::playback, Scene::AnimPhase::wave,
+        Scene::AnimPhase::delay, Scene::AnimPhase::fadeOut};
+
+    // by number of spheres first, so each scene is only created once
+    for (const int64_t numSpheres : sphereCounts)
+    {
+        benchmark::RegisterBenchmark("renderText", renderText)
+            ->Arg(numSpheres)
+            ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark("generateSpheres", generateSpheres)
+            ->Arg(numSpheres)
+            ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark("computeAnimations", computeAnimations)
+            ->Arg(numSpheres)
+            ->Unit(benchmark::kMillisecond)
+            ->UseRealTime();
+        for (const Scene::AnimPhase phase : phases)
+        {
+            const std::string name =
+                std::string("animate/") + Scene::phaseName(phase);
+            benchmark::RegisterBenchmark(name.c_str(), animate, phase)
+                ->Arg(numSpheres)
+                ->Unit(benchmark::kMillisecond)
+                ->UseRealTime();
+        }
+        for (const Scene::AnimPhase phase : phases)
+        {
+            // nothing is committed while the spheres wait
+            if (phase == Scene::AnimPhase::delay)
+            {
+                continue;
+            }
+            const std::string name =
+                std::string("commit/") + Scene::phaseName(phase);
+            benchmark::RegisterBenchmark(name.c_str(), commit, phase)
+                ->Arg(numSpheres)
+                ->Unit(benchmark::kMillisecond)
+                ->UseRealTime();
+        }
+    }
+
+    benchmark::RegisterBenchmark("hsl2RGB", hsl2RGB);
+    benchmark::RegisterBenchmark("writePPM", writePPM)
+        ->Args({1920, 1080})
+        ->Args({3840, 2160})
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    // OSPRay removes its own arguments, like --osp:numthreads
+    if (ospInit(&argc, const_cast<const char **>(argv)) != OSP_NO_ERROR)
+    {
+        return 1;
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+    benchmark::AddCustomContext(
+        "kernels", animkernels::isaName(animkernels::detectIsa()));
+
+    // timings of a wrong animation are meaningless
+    Scene &checkedScene = getScene(sphereCounts[0]);
+    if (!SceneBenchmark::checkPlayback(checkedScene) ||
+        !SceneBenchmark::checkKernels(checkedScene))
+    {
+        cachedScene.reset();
+        ospShutdown();
+        return 1;
+    }
+
+    registerBenchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    // scenes hold OSPRay objects
+    cachedScene.reset();
+    ospShutdown();
+    return 0;
+}
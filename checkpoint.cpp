@@ -0,0 +1,128 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include "framesinks.h"
+
+namespace
+{
+// Read a small file, returns an empty string if it doesn't exist
+std::string readFile(const std::string &fileName)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    std::ostringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+// Write a file through a temporary one which is then renamed, so the file is
+// either complete or missing if the process is killed
+bool writeFileAtomically(const std::string &fileName,
+                         const std::string &content)
+{
+    // several processes may write the same file
+    const std::string tmpName =
+        fileName + "." + std::to_string(std::random_device{}()) + ".tmp";
+    FILE *file = fopen(tmpName.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    bool written =
+        fwrite(content.data(), 1, content.size(), file) == content.size();
+    written = (fclose(file) == 0) && written;
+
+    std::error_code error;
+    if (written)
+    {
+        std::filesystem::rename(tmpName, fileName, error);
+    }
+    if (!written || error)
+    {
+        std::remove(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string getMarkerName(const std::string &fileName)
+{
+    return fileName + ".done";
+}
+
+// FNV-1a, which unlike std::hash gives the same hash in every build
+std::uint64_t hashSettings(const std::string &settings)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (const char c : settings)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+} // namespace
+
+Checkpoint::Checkpoint(const std::string &prefix)
+    : _prefix(prefix)
+{
+}
+
+bool Checkpoint::open(const std::string &settings, bool restart)
+{
+    const std::string manifestName = _prefix + ".manifest";
+    const std::string previousSettings = readFile(manifestName);
+    _settingsHash = hashSettings(settings);
+    _resuming = !restart && (previousSettings == settings);
+
+    if ((previousSettings != settings) &&
+        !writeFileAtomically(manifestName, settings))
+    {
+        fprintf(stderr, "Writing '%s' failed\n", manifestName.c_str());
+    }
+    return _resuming || previousSettings.empty();
+}
+
+bool Checkpoint::isComplete(int frameIndex) const
+{
+    if (!_resuming)
+    {
+        return false;
+    }
+
+    // the marker holds the size of the complete file, markers left by a run
+    // with other settings don't count
+    const std::string fileName = PPMSink::getFileName(_prefix, frameIndex);
+    std::istringstream marker(readFile(getMarkerName(fileName)));
+    std::string sizeKey, settingsKey;
+    std::uintmax_t size = 0;
+    std::uint64_t settingsHash = 0;
+    if (!(marker >> sizeKey >> size >> settingsKey >> std::hex >>
+          settingsHash) ||
+        (sizeKey != "size") || (settingsKey != "settings") ||
+        (settingsHash != _settingsHash))
+    {
+        return false;
+    }
+
+    std::error_code error;
+    const std::uintmax_t fileSize = std::filesystem::file_size(fileName, error);
+    return !error && (fileSize == size);
+}
+
+void Checkpoint::markComplete(int frameIndex) const
+{
+    const std::string fileName = PPMSink::getFileName(_prefix, frameIndex);
+    std::error_code error;
+    const std::uintmax_t fileSize = std::filesystem::file_size(fileName, error);
+    std::ostringstream marker;
+    marker << "size " << fileSize << "\nsettings " << std::hex << _settingsHash
+           << "\n";
+    if (error || !writeFileAtomically(getMarkerName(fileName), marker.str()))
+    {
+        fprintf(stderr, "Marking '%s' as complete failed\n", fileName.c_str());
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Progress of a sequence rendered to PPM files, so a render which was
+// interrupted can resume where it stopped.
+// A manifest records the settings frames are rendered with, and each complete
+// frame gets a marker holding the size of its file and a hash of the settings.
+// Both are written atomically, a frame without a marker matching its file and
+// the current settings is rendered again
+class Checkpoint
+{
+public:
+    // Frames are written to PPM files with the given prefix
+    explicit Checkpoint(const std::string &prefix);
+
+    // Start recording progress for frames rendered with the given settings.
+    // Progress of a previous run is kept only if it used the same settings,
+    // returns false if it was discarded
+    bool open(const std::string &settings, bool restart);
+
+    // Tell if a frame was completely written
+    bool isComplete(int frameIndex) const;
+    // Record that a frame was completely written, can be called from any
+    // thread
+    void markComplete(int frameIndex) const;
+
+private:
+    const std::string _prefix;
+    std::uint64_t _settingsHash = 0;
+    bool _resuming = false;
+};
@@ -0,0 +1,51 @@
+#include "commitscheduler.h"
+
+#include <algorithm>
+
+#include "trace.h"
+
+void CommitScheduler::markDirty(OSPObject object, Stage stage)
+{
+    // only a handful of objects change in a frame, a linear search is enough
+    if (!isDirty(object))
+    {
+        _dirty[int(stage)].push_back(object);
+    }
+}
+
+bool CommitScheduler::isDirty(OSPObject object) const
+{
+    for (const auto &objects : _dirty)
+    {
+        if (std::find(objects.begin(), objects.end(), object) != objects.end())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CommitScheduler::discard(OSPObject object)
+{
+    for (auto &objects : _dirty)
+    {
+        objects.erase(std::remove(objects.begin(), objects.end(), object),
+                      objects.end());
+    }
+}
+
+size_t CommitScheduler::flush()
+{
+    TRACE_SCOPE("CommitScheduler::flush");
+    _numCommits = 0;
+    for (auto &objects : _dirty)
+    {
+        for (OSPObject object : objects)
+        {
+            ospCommit(object);
+        }
+        _numCommits += objects.size();
+        objects.clear();
+    }
+    return _numCommits;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ospray/ospray.h"
+
+#include <cstddef>
+#include <vector>
+
+// Collects the OSPRay objects modified during a frame and commits each of them
+// once, before the objects using them. Objects are committed by stage, so a
+// geometry is committed before its model, which is committed before its
+// instances, and so on
+class CommitScheduler
+{
+public:
+    enum class Stage
+    {
+        geometry,
+        model,
+        instance,
+        world,
+        camera,
+        renderer,
+        numStages
+    };
+
+    // Commit the object on the next flush, along with the others of its stage
+    void markDirty(OSPObject object, Stage stage);
+    bool isDirty(OSPObject object) const;
+    // Forget an object which is released before the next flush
+    void discard(OSPObject object);
+
+    // Commit the dirty objects and return how many were committed
+    size_t flush();
+    // Number of objects committed by the last flush
+    size_t getNumCommits() const { return _numCommits; }
+
+private:
+    std::vector<OSPObject> _dirty[int(Stage::numStages)];
+    size_t _numCommits = 0;
+};
@@ -0,0 +1,229 @@
+#include "framesinks.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "checkpoint.h"
+#include "trace.h"
+#include "utils.h"
+
+using namespace ospcommon;
+
+namespace
+{
+// Convert RGBA pixels to planar YUV 4:2:0, chroma being averaged over 2x2
+// pixels. Uses BT.601 limited range, which is what encoders assume for
+// untagged streams.
+// OSPRay frame buffers start with the bottom row, rows are flipped
+void convertToYUV420(const uint8_t *rgba, const vec2i &size, uint8_t *yuv)
+{
+    const size_t width = size.x;
+    const size_t height = size.y;
+    const size_t chromaWidth = (width + 1) / 2;
+    const size_t chromaHeight = (height + 1) / 2;
+    uint8_t *yPlane = yuv;
+    uint8_t *uPlane = yPlane + width * height;
+    uint8_t *vPlane = uPlane + chromaWidth * chromaHeight;
+
+    for (size_t y = 0; y < height; ++y)
+    {
+        const uint8_t *in = rgba + (height - 1 - y) * width * 4;
+        uint8_t *out = yPlane + y * width;
+        for (size_t x = 0; x < width; ++x)
+        {
+            const int r = in[4 * x + 0];
+            const int g = in[4 * x + 1];
+            const int b = in[4 * x + 2];
+            out[x] = uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        }
+    }
+
+    for (size_t cy = 0; cy < chromaHeight; ++cy)
+    {
+        const size_t y0 = 2 * cy;
+        const size_t y1 = std::min(y0 + 1, height - 1);
+        const uint8_t *in0 = rgba + (height - 1 - y0) * width * 4;
+        const uint8_t *in1 = rgba + (height - 1 - y1) * width * 4;
+        uint8_t *u = uPlane + cy * chromaWidth;
+        uint8_t *v = vPlane + cy * chromaWidth;
+        for (size_t cx = 0; cx < chromaWidth; ++cx)
+        {
+            // the last column is repeated when the width is odd
+            const size_t x0 = 8 * cx;
+            const size_t x1 = (2 * cx + 1 < width) ? x0 + 4 : x0;
+
+            // sums of 4 pixels, the offset keeps values positive before
+            // dividing
+            const int r = in0[x0 + 0] + in0[x1 + 0] + in1[x0 + 0] + in1[x1 + 0];
+            const int g = in0[x0 + 1] + in0[x1 + 1] + in1[x0 + 1] + in1[x1 + 1];
+            const int b = in0[x0 + 2] + in0[x1 + 2] + in1[x0 + 2] + in1[x1 + 2];
+            const int offset = 128 * 1024 + 512;
+            u[cx] = uint8_t((-38 * r - 74 * g + 112 * b + offset) >> 10);
+            v[cx] = uint8_t((112 * r - 94 * g - 18 * b + offset) >> 10);
+        }
+    }
+}
+} // namespace
+
+PPMSink::PPMSink(const std::string &prefix, const vec2i &size,
+                 const Checkpoint *checkpoint)
+    : _prefix(prefix)
+    , _size(size)
+    , _checkpoint(checkpoint)
+{
+}
+
+std::string PPMSink::getFileName(const std::string &prefix, int frameIndex)
+{
+    return prefix + std::to_string(frameIndex) + ".ppm";
+}
+
+void PPMSink::write(int frameIndex, const uint32_t *pixels)
+{
+    // the file may be a hard link left by a previous run, don't overwrite the
+    // frames sharing it
+    const std::string fileName = getFileName(_prefix, frameIndex);
+    std::remove(fileName.c_str());
+    if (utils::writePPM(fileName.c_str(), _size, pixels) && _checkpoint)
+    {
+        _checkpoint->markComplete(frameIndex);
+    }
+}
+
+void PPMSink::repeat(int frameIndex, int sourceIndex)
+{
+    const std::string fileName = getFileName(_prefix, frameIndex);
+    const std::string sourceName = getFileName(_prefix, sourceIndex);
+
+    std::error_code error;
+    std::filesystem::remove(fileName, error);
+    std::filesystem::create_hard_link(sourceName, fileName, error);
+    if (error)
+    {
+        std::filesystem::copy_file(sourceName, fileName, error);
+    }
+    if (error)
+    {
+        fprintf(stderr, "Repeating '%s' as '%s' failed: %s\n",
+                sourceName.c_str(), fileName.c_str(), error.message().c_str());
+    }
+    else if (_checkpoint)
+    {
+        _checkpoint->markComplete(frameIndex);
+    }
+}
+
+StreamSink::StreamSink(const std::string &path, StreamFormat format,
+                       const vec2i &size, int frameRate, int firstFrame)
+    : _format(format)
+    , _size(size)
+    , _nextFrame(firstFrame)
+{
+    if (path == "-")
+    {
+#ifdef _WIN32
+        // don't let the C runtime translate line endings in the frames
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        _file = stdout;
+    }
+    else
+    {
+        _file = fopen(path.c_str(), "wb");
+        if (_file == nullptr)
+        {
+            fprintf(stderr, "fopen('%s', 'wb') failed: %d\n", path.c_str(),
+                    errno);
+            _failed = true;
+            return;
+        }
+        _ownsFile = true;
+    }
+
+    if (_format == StreamFormat::y4m)
+    {
+        fprintf(_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg "
+                       "XCOLORRANGE=LIMITED\n",
+                size.x, size.y, frameRate);
+    }
+}
+
+StreamSink::~StreamSink()
+{
+    if (_file == nullptr)
+    {
+        return;
+    }
+    fflush(_file);
+    if (_ownsFile)
+    {
+        fclose(_file);
+    }
+}
+
+void StreamSink::write(int frameIndex, const uint32_t *pixels)
+{
+    // convert without holding the lock, so frames are converted in parallel
+    const uint8_t *rgba = reinterpret_cast<const uint8_t *>(pixels);
+    thread_local std::vector<uint8_t> converted;
+    TRACE_SCOPE("StreamSink::write");
+    if (_format == StreamFormat::y4m)
+    {
+        converted.resize(size_t(_size.x) * _size.y +
+                         2 * size_t((_size.x + 1) / 2) * ((_size.y + 1) / 2));
+        convertToYUV420(rgba, _size, converted.data());
+    }
+    else
+    {
+        converted.resize(size_t(_size.x) * _size.y * 3);
+        utils::rgbaToRGB(_size, pixels, converted.data());
+    }
+
+    // then wait for the previous frames to be written. The frame is kept in
+    // case it is repeated, and the previous one is reused for converting
+    std::unique_lock<std::mutex> lock(_mutex);
+    writeInOrder(frameIndex, lock, converted);
+    converted.swap(_lastFrame);
+    ++_nextFrame;
+    lock.unlock();
+    _frameWritten.notify_all();
+}
+
+void StreamSink::repeat(int frameIndex, int sourceIndex)
+{
+    assert(sourceIndex == frameIndex - 1);
+    std::unique_lock<std::mutex> lock(_mutex);
+    writeInOrder(frameIndex, lock, _lastFrame);
+    ++_nextFrame;
+    lock.unlock();
+    _frameWritten.notify_all();
+}
+
+void StreamSink::writeInOrder(int frameIndex,
+                              std::unique_lock<std::mutex> &lock,
+                              const std::vector<uint8_t> &frame)
+{
+    _frameWritten.wait(lock, [&]() { return frameIndex == _nextFrame; });
+    if (_failed)
+    {
+        return;
+    }
+
+    bool written =
+        (_format != StreamFormat::y4m) || (fputs("FRAME\n", _file) >= 0);
+    written = written &&
+              (fwrite(frame.data(), 1, frame.size(), _file) == frame.size());
+    if (!written)
+    {
+        fprintf(stderr, "Writing frame %d to the stream failed: %d\n",
+                frameIndex, errno);
+        _failed = true;
+    }
+}
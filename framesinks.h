@@ -0,0 +1,74 @@
+#pragma once
+
+#include "framewriter.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Checkpoint;
+
+// Write each frame to its own PPM file, named after a prefix and the frame
+// index. Repeated frames are hard links to the file of the source frame when
+// the file system supports them, copies otherwise.
+// Complete files are recorded by the checkpoint, if any
+class PPMSink : public FrameSink
+{
+public:
+    PPMSink(const std::string &prefix, const ospcommon::vec2i &size,
+            const Checkpoint *checkpoint = nullptr);
+
+    static std::string getFileName(const std::string &prefix, int frameIndex);
+
+    void write(int frameIndex, const uint32_t *pixels) override;
+    void repeat(int frameIndex, int sourceIndex) override;
+
+private:
+    const std::string _prefix;
+    const ospcommon::vec2i _size;
+    const Checkpoint *_checkpoint;
+};
+
+// Formats of the video streams
+enum class StreamFormat
+{
+    y4m, // YUV4MPEG2 with 4:2:0 chroma subsampling
+    rgb, // Raw RGB24 frames without any header
+};
+
+// Write all the frames to a single video stream, which can be a file, a named
+// pipe or the standard output ("-"), so an encoder can consume them live.
+// Frames are converted in parallel but written in order, they must be written
+// with consecutive indices. Streams have no way to tell a frame is repeated,
+// only the previous frame can be repeated and it is written again
+class StreamSink : public FrameSink
+{
+public:
+    StreamSink(const std::string &path, StreamFormat format,
+               const ospcommon::vec2i &size, int frameRate, int firstFrame);
+    ~StreamSink() override;
+
+    // Tell if the stream could be opened
+    bool isOpen() const { return _file != nullptr; }
+
+    void write(int frameIndex, const uint32_t *pixels) override;
+    void repeat(int frameIndex, int sourceIndex) override;
+
+private:
+    // Write a converted frame, once the previous ones are written
+    void writeInOrder(int frameIndex, std::unique_lock<std::mutex> &lock,
+                      const std::vector<uint8_t> &frame);
+
+    const StreamFormat _format;
+    const ospcommon::vec2i _size;
+    FILE *_file = nullptr;
+    bool _ownsFile = false;
+
+    std::mutex _mutex;
+    std::condition_variable _frameWritten;
+    int _nextFrame; // Frames are written in order
+    bool _failed = false;
+    std::vector<uint8_t> _lastFrame; // Converted, to repeat it
+};
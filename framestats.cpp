@@ -0,0 +1,51 @@
+#include "framestats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+FrameStats::FrameStats(size_t size)
+    : _values(std::max<size_t>(size, 1))
+{
+}
+
+void FrameStats::add(float value)
+{
+    _values[_next] = value;
+    _next = (_next + 1) % _values.size();
+    _count = std::min(_count + 1, _values.size());
+}
+
+float FrameStats::getMean() const
+{
+    if (_count == 0)
+    {
+        return 0.f;
+    }
+    return std::accumulate(_values.begin(), _values.begin() + _count, 0.f) /
+           _count;
+}
+
+float FrameStats::getMax() const
+{
+    if (_count == 0)
+    {
+        return 0.f;
+    }
+    return *std::max_element(_values.begin(), _values.begin() + _count);
+}
+
+float FrameStats::getPercentile(float fraction) const
+{
+    if (_count == 0)
+    {
+        return 0.f;
+    }
+
+    // nearest rank, so the 100th percentile is the maximum
+    std::vector<float> sorted(_values.begin(), _values.begin() + _count);
+    const size_t rank = size_t(std::ceil(fraction * _count));
+    const size_t index = std::min(std::max<size_t>(rank, 1), _count) - 1;
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index];
+}
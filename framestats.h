@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Rolling window of the latest values of a frame timing, to plot them and get
+// their statistics
+class FrameStats
+{
+public:
+    explicit FrameStats(size_t size = 240);
+
+    // Add the value of a new frame, replacing the oldest one once full
+    void add(float value);
+
+    // Values for ImGui::PlotLines, the oldest one being at the offset
+    const float *getValues() const { return _values.data(); }
+    int getCount() const { return int(_count); }
+    int getOffset() const { return _count < _values.size() ? 0 : int(_next); }
+
+    float getMean() const;
+    float getMax() const;
+    // Value which the given fraction of the frames don't exceed, like 0.95
+    // for the 95th percentile
+    float getPercentile(float fraction) const;
+
+private:
+    std::vector<float> _values;
+    size_t _next = 0;  // Where the next value goes
+    size_t _count = 0; // Number of values added, up to the size
+};
@@ -0,0 +1,178 @@
+#include "framewriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "trace.h"
+
+using namespace ospcommon;
+
+namespace
+{
+using Clock = std::chrono::high_resolution_clock;
+
+float secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<float>(Clock::now() - start).count();
+}
+} // namespace
+
+FrameWriter::FrameWriter(std::unique_ptr<FrameSink> sink, const vec2i &size,
+                         int numThreads, int numBuffers)
+    : _sink(std::move(sink))
+{
+    // one buffer per thread at least, otherwise some would never work
+    numThreads = std::max(numThreads, 1);
+    numBuffers = std::max(numBuffers, numThreads);
+
+    _buffers.resize(numBuffers);
+    for (size_t i = 0; i < _buffers.size(); ++i)
+    {
+        _buffers[i].resize(size_t(size.x) * size.y);
+        _freeBuffers.push_back(i);
+    }
+
+    for (int i = 0; i < numThreads; ++i)
+    {
+        _threads.emplace_back([this, i]() {
+            trace::setThreadName("writer " + std::to_string(i));
+            run();
+        });
+    }
+}
+
+FrameWriter::~FrameWriter()
+{
+    flush();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _jobAdded.notify_all();
+    for (auto &thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+void FrameWriter::write(int frameIndex, const uint32_t *pixels)
+{
+    TRACE_SCOPE("FrameWriter::write");
+
+    // wait for a free buffer, this is where the rendering is held back when
+    // writing can't keep up
+    size_t buffer;
+    {
+        const auto start = Clock::now();
+        std::unique_lock<std::mutex> lock(_mutex);
+        _jobDone.wait(lock, [&]() { return !_freeBuffers.empty(); });
+        _waitTime += secondsSince(start);
+
+        buffer = _freeBuffers.back();
+        _freeBuffers.pop_back();
+    }
+
+    // the buffer is ours until it is queued, copy without holding the lock
+    std::memcpy(_buffers[buffer].data(), pixels,
+                _buffers[buffer].size() * sizeof(uint32_t));
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(Job{frameIndex, -1, buffer});
+        ++_numPending;
+    }
+    _jobAdded.notify_one();
+}
+
+void FrameWriter::repeat(int frameIndex, int sourceIndex)
+{
+    // the source frame must be completely written first. Repeated frames are
+    // not rendered, so there is not much to overlap with anyway
+    flush();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(Job{frameIndex, sourceIndex, 0});
+        ++_numPending;
+    }
+    _jobAdded.notify_one();
+}
+
+void FrameWriter::flush()
+{
+    const auto start = Clock::now();
+    std::unique_lock<std::mutex> lock(_mutex);
+    _jobDone.wait(lock, [&]() { return _numPending == 0; });
+    _waitTime += secondsSince(start);
+}
+
+float FrameWriter::getWriteTime() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _numWriting > 0 ? _writeTime + secondsSince(_writeStart)
+                           : _writeTime;
+}
+
+float FrameWriter::getWaitTime() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _waitTime;
+}
+
+float FrameWriter::getHiddenTime() const
+{
+    // the caller only waits while frames are being written, the rest of the
+    // writing time overlapped with its work
+    return std::max(getWriteTime() - getWaitTime(), 0.f);
+}
+
+void FrameWriter::run()
+{
+    for (;;)
+    {
+        Job job{};
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _jobAdded.wait(lock, [&]() { return _stopping || !_jobs.empty(); });
+            if (_jobs.empty())
+            {
+                return;
+            }
+            job = _jobs.front();
+            _jobs.pop_front();
+
+            // the writing time runs while any thread writes, so frames written
+            // in parallel are not counted several times
+            if (_numWriting++ == 0)
+            {
+                _writeStart = Clock::now();
+            }
+        }
+
+        const bool repeated = job.sourceIndex >= 0;
+        if (repeated)
+        {
+            _sink->repeat(job.frameIndex, job.sourceIndex);
+        }
+        else
+        {
+            _sink->write(job.frameIndex, _buffers[job.buffer].data());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (--_numWriting == 0)
+            {
+                _writeTime += secondsSince(_writeStart);
+            }
+            if (!repeated)
+            {
+                _freeBuffers.push_back(job.buffer);
+            }
+            --_numPending;
+        }
+        _jobDone.notify_all();
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <ospcommon/vec.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Destination of the frames written by a FrameWriter
+class FrameSink
+{
+public:
+    virtual ~FrameSink() = default;
+
+    // Write the pixels of a frame, as mapped from an OSPRay frame buffer.
+    // Called from the writer threads, possibly several frames at once
+    virtual void write(int frameIndex, const uint32_t *pixels) = 0;
+    // Write a frame identical to a previous one, which is already written
+    virtual void repeat(int frameIndex, int sourceIndex) = 0;
+};
+
+// Write rendered frames to a sink in the background, so rendering the next
+// frame overlaps the conversion and disk writes of the previous ones.
+// Pixels are copied into a pool of reusable buffers, a frame waits for a free
+// one when all of them are pending, which bounds the memory used when
+// rendering is faster than writing.
+class FrameWriter
+{
+public:
+    // Frames all have the same size
+    FrameWriter(std::unique_ptr<FrameSink> sink, const ospcommon::vec2i &size,
+                int numThreads = 2, int numBuffers = 4);
+    // Wait for all the frames to be written
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    // Queue a copy of the pixels of a frame to be written, the pixels can be
+    // released as soon as it returns
+    void write(int frameIndex, const uint32_t *pixels);
+    // Queue a frame identical to a previous one, which costs much less than
+    // writing the same pixels again
+    void repeat(int frameIndex, int sourceIndex);
+    // Wait for all the queued frames to be written
+    void flush();
+
+    // Wall time during which the background threads were writing frames, in
+    // seconds. Frames written at the same time only count once
+    float getWriteTime() const;
+    // Time the caller spent waiting for the background threads, in seconds
+    float getWaitTime() const;
+    // Wall time during which frames were written while the caller went on
+    // rendering, rather than waiting for them, in seconds
+    float getHiddenTime() const;
+
+private:
+    struct Job
+    {
+        int frameIndex;
+        int sourceIndex; // Frame repeated, -1 to write the pixels of a buffer
+        size_t buffer;
+    };
+
+    void run();
+
+    std::unique_ptr<FrameSink> _sink;
+    std::vector<std::vector<uint32_t>> _buffers;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _jobAdded;
+    std::condition_variable _jobDone;
+    std::vector<size_t> _freeBuffers;
+    std::deque<Job> _jobs;
+    size_t _numPending = 0; // Jobs queued or being written
+    size_t _numWriting = 0; // Jobs being written
+    bool _stopping = false;
+    std::chrono::high_resolution_clock::time_point _writeStart;
+    float _writeTime = 0.f; // Excluding the writes in progress
+    float _waitTime = 0.f;
+
+    std::vector<std::thread> _threads;
+};
@@ -1,10 +1,27 @@
+#include "checkpoint.h"
+#include "commitscheduler.h"
+#include "framesinks.h"
+#include "framestats.h"
+#include "framewriter.h"
 #include "ospray-tutorial/GLFWOSPRayWindow.h"
+#include "options.h"
 #include "scene.h"
+#include "trace.h"
 #include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <imgui.h>
 #include <iostream>
 #include <sstream>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 using namespace ospcommon;
 
@@ -34,10 +51,43 @@ OSPRenderer createRenderer()
     return renderer;
 }
 
+// State of the scene shown by the UI. The scene is animated on the render
+// thread, which copies its state for the UI thread after each tick
+struct SceneStatus
+{
+    int frame = 0;
+    int numFrames = 0;
+    Scene::AnimPhase phase = Scene::AnimPhase::playback;
+    animkernels::Isa isa = animkernels::Isa::scalar;
+    bool partitioning = true;
+    size_t numSpheres = 0;
+    size_t numVisible = 0;
+    size_t numDirty = 0;
+    size_t numCreated = 0;
+    float commitTime = 0.f;
+};
+
+SceneStatus getStatus(const Scene &scene)
+{
+    SceneStatus status;
+    status.frame = std::max(scene.getFrame(), 0);
+    status.numFrames = scene.getNumFrames();
+    status.phase = scene.getPhase();
+    status.isa = scene.getKernelsIsa();
+    status.partitioning = scene.getPartitioning();
+    status.numSpheres = scene.getNumSpheres();
+    status.numVisible = scene.getNumVisibleSpheres();
+    status.numDirty = scene.getNumDirtySpheres();
+    status.numCreated = scene.getNumCreatedObjects();
+    status.commitTime = scene.getCommitTime();
+    return status;
+}
+
 // Based on OSPRay tutorial => ospTutorialBouncingSpheres.cpp
-void renderToScreen(int argc, const char **argv)
+void renderToScreen(const options::Options &options)
 {
-    Scene scene{};
+    // a different animation at each run, unless the seed is given
+    Scene scene{options.hasSeed ? options.seed : Scene::randomSeed()};
 
     // create OSPRay renderer
     OSPRenderer renderer = createRenderer();
@@ -45,28 +95,202 @@ void renderToScreen(int argc, const char **argv)
     // create a GLFW OSPRay window: this object will create and manage the
     // OSPRay frame buffer and camera directly
     auto glfwOSPRayWindow = std::unique_ptr<GLFWOSPRayWindow>(
-        new GLFWOSPRayWindow(vec2i{1140, 640}, box3f(vec3f(-1.f), vec3f(1.f)),
-                             scene.getWorld(), renderer));
+        new GLFWOSPRayWindow(options.width > 0
+                                 ? vec2i{options.width, options.height}
+                                 : vec2i{1140, 640},
+                             box3f(vec3f(-1.f), vec3f(1.f)), scene.getWorld(),
+                             renderer));
+
+    // the scene changes are committed by the window along with the camera and
+    // renderer ones, once per frame
+    scene.setCommitScheduler(glfwOSPRayWindow->getCommitScheduler());
+
+    // the animation can be paused to scrub through it
+    std::atomic<bool> paused{false};
+
+    // the UI thread only sees a copy of the scene state, changes are posted
+    // to the render thread
+    std::mutex statusMutex;
+    SceneStatus status = getStatus(scene);
+    const auto updateStatus = [&]() {
+        const SceneStatus newStatus = getStatus(scene);
+        std::lock_guard<std::mutex> lock(statusMutex);
+        status = newStatus;
+    };
 
     // register a callback with the GLFW OSPRay window to update the model every
-    // frame
+    // frame. It runs on the render thread
     glfwOSPRayWindow->registerDisplayCallback(
         [&](GLFWOSPRayWindow *glfwOSPRayWindow) {
+            if (paused)
+            {
+                return;
+            }
+
             // update the spheres coordinates and geometry
-            if (scene.tick())
+            const bool animated = scene.tick();
+            if (animated && scene.hasChanged())
             {
-                // update the model on the GLFW window
-                glfwOSPRayWindow->setModel(scene.getWorld());
+                // update the model on the GLFW window, frames keep part of
+                // their history when few spheres moved
+                const float changedFraction =
+                    float(scene.getNumDirtySpheres()) /
+                    std::max<size_t>(scene.getNumSpheres(), 1);
+                glfwOSPRayWindow->setModel(scene.getWorld(), changedFraction);
             }
+            updateStatus();
         });
 
-    glfwOSPRayWindow->registerImGuiCallback([=]() {
+    // rolling statistics of the rendered frame times and of their stages.
+    // Textures are uploaded and buffers swapped on the UI thread, in parallel
+    FrameStats frameStats;
+    enum Stage
+    {
+        animate,
+        commit,
+        render,
+        readback,
+        other,
+        upload,
+        swap,
+        numStages
+    };
+    const char *stageNames[numStages] = {"animate",  "commit", "render",
+                                         "readback", "other",  "upload",
+                                         "swap"};
+    std::vector<FrameStats> stageStats(numStages);
+    size_t lastFrameIndex = 0;
+
+    glfwOSPRayWindow->registerImGuiCallback([&]() {
+        SceneStatus current;
+        {
+            std::lock_guard<std::mutex> lock(statusMutex);
+            current = status;
+        }
+
         static int spp = 1;
         if (ImGui::SliderInt("spp", &spp, 1, 64))
         {
-            ospSet1i(renderer, "spp", spp);
-            ospCommit(renderer);
+            const int newSpp = spp;
+            glfwOSPRayWindow->post([&, newSpp]() {
+                ospSet1i(renderer, "spp", newSpp);
+                glfwOSPRayWindow->getCommitScheduler().markDirty(
+                    renderer, CommitScheduler::Stage::renderer);
+            });
+        }
+
+        // switch animation kernels, to compare them against the scalar ones
+        static const char *isaNames[] = {
+            animkernels::isaName(animkernels::Isa::scalar),
+            animkernels::isaName(animkernels::Isa::avx2),
+            animkernels::isaName(animkernels::Isa::avx512)};
+        int isa = int(current.isa);
+        if (ImGui::Combo("kernels", &isa, isaNames, 3))
+        {
+            glfwOSPRayWindow->post([&, isa]() {
+                scene.setKernelsIsa(animkernels::Isa(isa));
+                updateStatus();
+            });
+        }
+
+        // compare commit times with and without static spheres partitioning
+        bool partitioning = current.partitioning;
+        if (ImGui::Checkbox("static partitioning", &partitioning))
+        {
+            glfwOSPRayWindow->post([&, partitioning]() {
+                scene.setPartitioning(partitioning);
+                updateStatus();
+            });
+        }
+        ImGui::Text("commit: %.2f ms",
+                    current.commitTime +
+                        glfwOSPRayWindow->getFrameTimes().commit);
+
+        // blend frames over time while the spheres move, rather than showing
+        // a single sample per pixel
+        bool temporal = glfwOSPRayWindow->getTemporalAccumulation();
+        if (ImGui::Checkbox("temporal accumulation", &temporal))
+        {
+            glfwOSPRayWindow->setTemporalAccumulation(temporal);
+        }
+        ImGui::SameLine();
+        ImGui::Text("weight %.2f", glfwOSPRayWindow->getTemporalWeight());
+
+        // jump to any frame of the animation
+        bool pause = paused;
+        if (ImGui::Checkbox("pause", &pause))
+        {
+            paused = pause;
+        }
+        int frame = current.frame;
+        if (ImGui::SliderInt("frame", &frame, 0, current.numFrames - 1))
+        {
+            glfwOSPRayWindow->post([&, frame]() {
+                if (scene.evaluateAt(frame))
+                {
+                    glfwOSPRayWindow->setModel(scene.getWorld());
+                }
+                updateStatus();
+            });
+        }
+
+        // timings of the last rendered frame, counted once
+        const auto &times = glfwOSPRayWindow->getFrameTimes();
+        if (times.index != lastFrameIndex)
+        {
+            lastFrameIndex = times.index;
+            frameStats.add(times.frame);
+            // the scene schedules its commits in the display callback, the
+            // window commits them right after
+            const float scheduleTime =
+                std::min(current.commitTime, times.callback);
+            const float stageTimes[numStages] = {
+                times.callback - scheduleTime,
+                scheduleTime + times.commit,
+                times.render,
+                times.readback,
+                std::max(times.frame - times.callback - times.commit -
+                             times.render - times.readback,
+                         0.f),
+                times.upload,
+                times.swap};
+            for (int stage = 0; stage < numStages; ++stage)
+            {
+                stageStats[stage].add(stageTimes[stage]);
+            }
+        }
+
+        if (!ImGui::CollapsingHeader("performance",
+                                     ImGuiTreeNodeFlags_DefaultOpen))
+        {
+            return;
+        }
+        const float meanTime = frameStats.getMean();
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "%.1f ms (%.1f fps)", meanTime,
+                 meanTime > 0.f ? 1000.f / meanTime : 0.f);
+        ImGui::PlotLines("frame time", frameStats.getValues(),
+                         frameStats.getCount(), frameStats.getOffset(), overlay,
+                         0.f, 1.2f * frameStats.getMax(), ImVec2(0.f, 60.f));
+        ImGui::Text("p50 %.2f ms, p95 %.2f ms, p99 %.2f ms",
+                    frameStats.getPercentile(0.5f),
+                    frameStats.getPercentile(0.95f),
+                    frameStats.getPercentile(0.99f));
+        for (int stage = 0; stage < numStages; ++stage)
+        {
+            if (stage == upload)
+            {
+                ImGui::Text("UI thread, %s upload",
+                            glfwOSPRayWindow->getUploadMode());
+            }
+            ImGui::Text("%-8s %6.2f ms", stageNames[stage],
+                        stageStats[stage].getMean());
         }
+        ImGui::Text("spheres: %zu visible of %zu, %zu dirty",
+                    current.numVisible, current.numSpheres, current.numDirty);
+        ImGui::Text("phase: %s", Scene::phaseName(current.phase));
+        ImGui::Text("OSPRay objects created: %zu", current.numCreated);
+        ImGui::Text("commits: %zu", glfwOSPRayWindow->getNumCommits());
     });
 
     // start the GLFW main loop, which will continuously render
@@ -75,15 +299,88 @@ void renderToScreen(int argc, const char **argv)
     ospRelease(renderer);
 }
 
+// Prefix of the PPM files
+std::string getPPMPrefix(const options::Options &options)
+{
+    return options.output.empty() ? "frame" : options.output;
+}
+
+// Create the destination of the frames rendered to files, returns nullptr if
+// it can't be opened
+std::unique_ptr<FrameSink> createFrameSink(const options::Options &options,
+                                           const vec2i &size,
+                                           const Scene &scene,
+                                           const Checkpoint *checkpoint)
+{
+    if (options.format == options::Format::ppm)
+    {
+        return std::unique_ptr<FrameSink>(
+            new PPMSink(getPPMPrefix(options), size, checkpoint));
+    }
+
+    const int frameRate = int(std::lround(1.f / scene.getFrameDuration()));
+    auto stream = std::unique_ptr<StreamSink>(new StreamSink(
+        options.output.empty() ? "-" : options.output,
+        options.format == options::Format::y4m ? StreamFormat::y4m
+                                               : StreamFormat::rgb,
+        size, frameRate, options.firstFrame));
+    if (!stream->isOpen())
+    {
+        return nullptr;
+    }
+    if (options.format == options::Format::rgb)
+    {
+        std::cerr << "Streaming raw rgb24 frames of " << size.x << "x"
+                  << size.y << " at " << frameRate << " fps" << std::endl;
+    }
+    return stream;
+}
+
 // Based on OSPRay tutorial => ospTutorial.c
-void renderToFiles(int argc, const char **argv)
+void renderToFiles(const options::Options &options)
 {
     // image size
     osp::vec2i imgSize;
-    imgSize.x = 1280; // width
-    imgSize.y = 720;  // height
+    imgSize.x = options.width > 0 ? options.width : 1280;   // width
+    imgSize.y = options.height > 0 ? options.height : 720;  // height
+
+    Scene scene{options.seed};
+
+    // keep the standard output clean when the frames are streamed to it
+    const bool streamToStdout =
+        (options.format != options::Format::ppm) &&
+        (options.output.empty() || (options.output == "-"));
+    std::ostream &log = streamToStdout ? std::cerr : std::cout;
+
+    // PPM files which were completely written by a previous run with the same
+    // settings are not rendered again. Streams can't be resumed. The animation
+    // kernels are not part of the settings: every instruction set moves the
+    // spheres bit for bit like the scalar kernels
+    std::unique_ptr<Checkpoint> checkpoint;
+    if (options.format == options::Format::ppm)
+    {
+        std::ostringstream settings;
+        settings << "seed " << options.seed << "\nsize " << imgSize.x << 'x'
+                 << imgSize.y << "\nspp " << options.spp << "\nvariance "
+                 << options.variance << "\nminSpp " << options.minSpp
+                 << "\nframes " << scene.getNumFrames() << '\n';
+        checkpoint.reset(new Checkpoint(getPPMPrefix(options)));
+        if (!checkpoint->open(settings.str(), options.restart) &&
+            !options.restart)
+        {
+            log << "Settings changed, frames rendered previously are discarded"
+                << std::endl;
+        }
+    }
 
-    Scene scene{};
+    // frames are written in the background while the next ones render
+    auto sink = createFrameSink(options, vec2i{imgSize.x, imgSize.y}, scene,
+                                checkpoint.get());
+    if (sink == nullptr)
+    {
+        return;
+    }
+    FrameWriter writer{std::move(sink), vec2i{imgSize.x, imgSize.y}};
 
     // create OSPRay model
     OSPModel model = scene.getWorld();
@@ -122,48 +419,209 @@ void renderToFiles(int argc, const char **argv)
     // set camera on the renderer
     ospSetObject(renderer, "camera", camera);
 
+    // with adaptive sampling, tiles which converged are not rendered anymore
+    const bool adaptive = options.variance > 0.f;
+    if (adaptive)
+    {
+        ospSet1f(renderer, "varianceThreshold", options.variance);
+    }
+
     // finally, commit the renderer
     ospCommit(renderer);
 
-    // create and setup framebuffer
+    // create and setup framebuffer, the variance buffer is needed by adaptive
+    // sampling to estimate how converged frames are
+    const uint32_t channels =
+        OSP_FB_COLOR | /*OSP_FB_DEPTH |*/ OSP_FB_ACCUM |
+        (adaptive ? OSP_FB_VARIANCE : 0);
     OSPFrameBuffer framebuffer =
-        ospNewFrameBuffer(imgSize, OSP_FB_SRGBA,
-                          OSP_FB_COLOR | /*OSP_FB_DEPTH |*/ OSP_FB_ACCUM);
+        ospNewFrameBuffer(imgSize, OSP_FB_SRGBA, channels);
+    const int minPasses = adaptive ? std::min(options.minSpp, options.spp)
+                                   : options.spp;
+    int totalPasses = 0;
+    int numFrames = 0;
+    int numRepeated = 0;
+    int numResumed = 0;
+    size_t renderedVersion = 0;
+
+    const int lastFrame = std::min(options.lastFrame, scene.getNumFrames());
+    log << "Generating frames " << options.firstFrame << " to " << lastFrame
+        << "..." << std::endl;
+
+    // Frames are numbered from 1 for naming output files
+    bool needsJump = true;
+    for (int frameIndex = options.firstFrame; frameIndex <= lastFrame;
+         ++frameIndex)
+    {
+        TRACE_SCOPE("frame");
+        if (checkpoint && checkpoint->isComplete(frameIndex))
+        {
+            ++numResumed;
+            needsJump = true;
+            continue;
+        }
 
-    std::cout << "Generating frames..." << std::endl;
+        // jump straight to the first frame of the range, or over the frames
+        // which were already complete, so rendering part of the sequence gives
+        // the same images as rendering all of it
+        const bool animated =
+            needsJump ? scene.evaluateAt(frameIndex - 1) : scene.tick();
+        if (!animated)
+        {
+            break;
+        }
 
-    // Count frames for naming output file
-    int frameIndex = 0;
-    std::ostringstream str{};
+        // the camera is static, nothing to render when the scene didn't change
+        // since the previous frame. Jumping always changes the scene
+        if (!needsJump && (scene.getVersion() == renderedVersion))
+        {
+            writer.repeat(frameIndex, frameIndex - 1);
+            ++numRepeated;
+            log << "Frame #" << frameIndex << " unchanged" << std::endl;
+            continue;
+        }
+        needsJump = false;
+        renderedVersion = scene.getVersion();
 
-    // Iterate until nothing to update
-    while (scene.tick())
-    {
-        ++frameIndex;
+        ospFrameBufferClear(framebuffer, channels);
 
-        ospFrameBufferClear(framebuffer, OSP_FB_COLOR | OSP_FB_ACCUM);
+        // render one sample per pixel per pass, which are accumulated to
+        // result in a better converged image. With adaptive sampling, stop as
+        // soon as the frame is converged enough
+        int passes = 0;
+        float variance = 0.f;
+        while (passes < options.spp)
+        {
+            TRACE_SCOPE("ospRenderFrame");
+            variance = ospRenderFrame(framebuffer, renderer, channels);
+            ++passes;
+            if ((passes >= minPasses) && (variance <= options.variance))
+            {
+                break;
+            }
+        }
+        totalPasses += passes;
+        ++numFrames;
 
-        // render 10 more frames, which are accumulated to result in a better
-        // converged image
-        for (int frames = 0; frames < 20; frames++)
-            ospRenderFrame(framebuffer, renderer, OSP_FB_COLOR | OSP_FB_ACCUM);
+        // write result, the frame buffer is only mapped while its pixels are
+        // copied
+        {
+            TRACE_SCOPE("ospMapFrameBuffer");
+            const uint32_t *fb =
+                (uint32_t *)ospMapFrameBuffer(framebuffer, OSP_FB_COLOR);
+            writer.write(frameIndex, fb);
+            ospUnmapFrameBuffer(fb, framebuffer);
+        }
 
-        // write result into file
-        str.str("");
-        str << "frame" << frameIndex << ".ppm";
-        const uint32_t *fb =
-            (uint32_t *)ospMapFrameBuffer(framebuffer, OSP_FB_COLOR);
-        utils::writePPM(str.str().data(), vec2i{imgSize.x, imgSize.y}, fb);
-        ospUnmapFrameBuffer(fb, framebuffer);
+        log << "Frame #" << frameIndex << " generated ("
+            << scene.getNumCommits() << " commits in "
+            << scene.getCommitTime() << " ms";
+        if (scene.getNumCreatedObjects() > 0)
+        {
+            log << ", " << scene.getNumCreatedObjects() << " objects created";
+        }
+        if (adaptive)
+        {
+            log << ", " << passes << " passes, variance " << variance;
+        }
+        log << ")" << std::endl;
+    }
 
-        std::cout << "Frame #" << frameIndex << " generated" << std::endl;
+    if (numResumed > 0)
+    {
+        log << numResumed << " frames were already complete" << std::endl;
+    }
+    if (numRepeated > 0)
+    {
+        log << numRepeated << " unchanged frames were not rendered again"
+            << std::endl;
     }
+    if (adaptive && (numFrames > 0))
+    {
+        const int fixedPasses = numFrames * options.spp;
+        log << "Adaptive sampling rendered " << totalPasses
+            << " passes instead of " << fixedPasses << " ("
+            << 100 * (fixedPasses - totalPasses) / fixedPasses << "% saved)"
+            << std::endl;
+    }
+
+    writer.flush();
+    log << "Writing frames took " << writer.getWriteTime() << " s, "
+        << writer.getHiddenTime() << " s hidden behind rendering" << std::endl;
 
     // final cleanups
     ospRelease(framebuffer);
     ospRelease(renderer);
 }
 
+// Split the frames rendered to files over several processes running this
+// program, and report the aggregate frame rate
+int renderWithWorkers(const char *program, const options::Options &options)
+{
+    // the number of frames only depends on the seed
+    const int numFrames = Scene{options.seed}.getNumFrames();
+    const int firstFrame = options.firstFrame;
+    const int lastFrame = std::min(options.lastFrame, numFrames);
+    if (firstFrame > lastFrame)
+    {
+        std::cerr << "No frame to render, the animation has " << numFrames
+                  << " frames" << std::endl;
+        return 1;
+    }
+    const int numRendered = lastFrame - firstFrame + 1;
+    const int numWorkers = std::min(options.workers, numRendered);
+
+    // share the cores between the workers
+    const unsigned int numThreads =
+        std::max(std::thread::hardware_concurrency() / numWorkers, 1u);
+
+    std::cout << "Generating frames " << firstFrame << " to " << lastFrame
+              << " with " << numWorkers << " workers..." << std::endl;
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    // each worker renders a contiguous range of frames, so it only has to
+    // jump once
+    std::vector<int> results(numWorkers);
+    std::vector<std::thread> threads;
+    for (int worker = 0; worker < numWorkers; ++worker)
+    {
+        const int workerFirst = firstFrame + worker * numRendered / numWorkers;
+        const int workerLast =
+            firstFrame + (worker + 1) * numRendered / numWorkers - 1;
+
+        std::string command =
+            std::string("\"") + program + "\" --osp:numthreads " +
+            std::to_string(numThreads) + " " +
+            options::workerArguments(options, workerFirst, workerLast);
+#ifdef _WIN32
+        // cmd.exe strips the quotes around the whole command line
+        command = "\"" + command + "\"";
+#endif
+        threads.emplace_back([command, &result = results[worker]]() {
+            result = std::system(command.c_str());
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    const float seconds = std::chrono::duration<float>(end - start).count();
+    std::cout << numRendered << " frames generated in " << seconds << " s ("
+              << numRendered / seconds << " fps)" << std::endl;
+
+    for (int worker = 0; worker < numWorkers; ++worker)
+    {
+        if (results[worker] != 0)
+        {
+            std::cerr << "Worker " << worker << " failed" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int main(int argc, const char **argv)
 {
     // initialize OSPRay; OSPRay parses (and removes) its commandline
@@ -180,11 +638,40 @@ int main(int argc, const char **argv)
         exit(error);
     });
 
-    renderToScreen(argc, argv);
-    //renderToFiles(argc, argv);
+    // then parse our own parameters
+    options::Options options;
+    if (!options::parse(argc, argv, options))
+    {
+        options::printUsage(argv[0]);
+        ospShutdown();
+        return 1;
+    }
+
+    // workers trace themselves, to their own files
+    const bool tracing = !options.trace.empty() && (options.workers == 0);
+    if (tracing)
+    {
+        trace::setEnabled(true);
+        trace::setThreadName("main");
+    }
+
+    int result = 0;
+    if (options.workers > 0)
+        result = renderWithWorkers(argv[0], options);
+    else if (options.mode == options::Mode::files)
+        renderToFiles(options);
+    else
+        renderToScreen(options);
+
+    if (tracing && !trace::write(options.trace))
+    {
+        std::cerr << "Writing trace '" << options.trace << "' failed"
+                  << std::endl;
+        result = 1;
+    }
 
     // cleanly shut OSPRay down
     ospShutdown();
 
-    return 0;
-}
\ No newline at end of file
+    return result;
+}
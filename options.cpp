@@ -0,0 +1,241 @@
+#include "options.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace options
+{
+namespace
+{
+// Parse a strictly positive integer
+bool parseCount(const std::string &text, int &value)
+{
+    if (text.empty())
+    {
+        return false;
+    }
+    char *end = nullptr;
+    const long parsed = std::strtol(text.c_str(), &end, 10);
+    if ((*end != '\0') || (parsed <= 0) ||
+        (parsed > std::numeric_limits<int>::max()))
+    {
+        return false;
+    }
+    value = int(parsed);
+    return true;
+}
+
+// Parse a frame range "first:last", both ends being optional, or a single
+// frame
+bool parseFrames(const std::string &text, Options &options)
+{
+    const size_t separator = text.find(':');
+    if (separator == std::string::npos)
+    {
+        if (!parseCount(text, options.firstFrame))
+        {
+            return false;
+        }
+        options.lastFrame = options.firstFrame;
+        return true;
+    }
+
+    const std::string first = text.substr(0, separator);
+    const std::string last = text.substr(separator + 1);
+    if (!first.empty() && !parseCount(first, options.firstFrame))
+    {
+        return false;
+    }
+    if (!last.empty() && !parseCount(last, options.lastFrame))
+    {
+        return false;
+    }
+    return options.firstFrame <= options.lastFrame;
+}
+
+// Parse an image size "widthxheight"
+bool parseSize(const std::string &text, Options &options)
+{
+    const size_t separator = text.find('x');
+    return (separator != std::string::npos) &&
+           parseCount(text.substr(0, separator), options.width) &&
+           parseCount(text.substr(separator + 1), options.height);
+}
+} // namespace
+
+bool parse(int argc, const char **argv, Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string option = argv[i];
+        if (option == "--restart")
+        {
+            options.restart = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << option << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+
+        bool valid = true;
+        if (option == "--mode")
+        {
+            valid = (value == "screen") || (value == "files");
+            options.mode = (value == "files") ? Mode::files : Mode::screen;
+        }
+        else if (option == "--frames")
+        {
+            valid = parseFrames(value, options);
+        }
+        else if (option == "--size")
+        {
+            valid = parseSize(value, options);
+        }
+        else if (option == "--spp")
+        {
+            valid = parseCount(value, options.spp);
+        }
+        else if (option == "--variance")
+        {
+            char *end = nullptr;
+            options.variance = std::strtof(value.c_str(), &end);
+            valid = !value.empty() && (*end == '\0') && (options.variance >= 0);
+        }
+        else if (option == "--min-spp")
+        {
+            valid = parseCount(value, options.minSpp);
+        }
+        else if (option == "--format")
+        {
+            valid = (value == "ppm") || (value == "y4m") || (value == "rgb");
+            options.format = (value == "y4m")   ? Format::y4m
+                             : (value == "rgb") ? Format::rgb
+                                                : Format::ppm;
+        }
+        else if (option == "--output")
+        {
+            valid = !value.empty();
+            options.output = value;
+        }
+        else if (option == "--seed")
+        {
+            char *end = nullptr;
+            options.seed = std::strtoul(value.c_str(), &end, 10);
+            options.hasSeed = true;
+            valid = !value.empty() && (*end == '\0');
+        }
+        else if (option == "--workers")
+        {
+            valid = parseCount(value, options.workers);
+        }
+        else if (option == "--trace")
+        {
+            valid = !value.empty();
+            options.trace = value;
+        }
+        else
+        {
+            std::cerr << "Unknown option " << option << std::endl;
+            return false;
+        }
+
+        if (!valid)
+        {
+            std::cerr << "Invalid value for " << option << ": " << value
+                      << std::endl;
+            return false;
+        }
+    }
+
+    // workers and video streams only make sense when rendering to files
+    if ((options.workers > 0) || (options.format != Format::ppm))
+    {
+        options.mode = Mode::files;
+    }
+    if ((options.workers > 0) && (options.format != Format::ppm))
+    {
+        std::cerr << "Video streams can't be split over workers" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void printUsage(const char *program)
+{
+    std::cerr
+        << "Usage: " << program << " [options]\n"
+        << "  --mode screen|files  render to a window or to files (screen)\n"
+        << "  --frames first:last  frames rendered to files, numbered from 1\n"
+        << "                       (all of them)\n"
+        << "  --size WxH           image size (1140x640 on screen, 1280x720\n"
+        << "                       in files)\n"
+        << "  --spp N              samples per pixel of each file (20)\n"
+        << "  --variance V         stop sampling a file once its estimated\n"
+        << "                       variance is below V, up to --spp (0, off)\n"
+        << "  --min-spp N          minimum samples per pixel with --variance\n"
+        << "                       (4)\n"
+        << "  --format ppm|y4m|rgb one PPM file per frame, or a YUV4MPEG2 or\n"
+        << "                       raw RGB24 video stream (ppm)\n"
+        << "  --output PATH        PPM files prefix (frame), or video stream\n"
+        << "                       path, - for the standard output (-)\n"
+        << "  --seed N             seed of the spheres random parameters\n"
+        << "                       (random on screen, 0 in files)\n"
+        << "  --workers N          split the frames rendered to files over N\n"
+        << "                       processes\n"
+        << "  --restart            render all the PPM files again, instead of\n"
+        << "                       resuming an interrupted render\n"
+        << "  --trace FILE         trace the stages of each frame to a CSV\n"
+        << "                       file, or a Chrome trace if FILE ends with\n"
+        << "                       .json\n";
+}
+
+std::string workerArguments(const Options &options, int firstFrame,
+                            int lastFrame)
+{
+    // floats are written with all their digits, so workers render with the
+    // exact same settings. The animation kernels are left to each worker:
+    // every instruction set moves the spheres bit for bit like the scalar
+    // kernels, so frames match whichever ones its CPU runs
+    std::ostringstream arguments;
+    arguments << std::setprecision(std::numeric_limits<float>::max_digits10);
+    arguments << "--mode files --frames " << firstFrame << ':' << lastFrame
+              << " --spp " << options.spp << " --seed " << options.seed;
+    if (options.variance > 0)
+    {
+        arguments << " --variance " << options.variance << " --min-spp "
+                  << options.minSpp;
+    }
+    if (!options.output.empty())
+    {
+        arguments << " --output \"" << options.output << '"';
+    }
+    if ((options.width > 0) && (options.height > 0))
+    {
+        arguments << " --size " << options.width << 'x' << options.height;
+    }
+    if (options.restart)
+    {
+        arguments << " --restart";
+    }
+    if (!options.trace.empty())
+    {
+        // one trace per worker, named after its frames
+        const size_t extension = options.trace.find_last_of('.');
+        const size_t directory = options.trace.find_last_of("/\\");
+        const size_t split = ((extension != std::string::npos) &&
+                              ((directory == std::string::npos) ||
+                               (extension > directory)))
+                                 ? extension
+                                 : options.trace.size();
+        arguments << " --trace \"" << options.trace.substr(0, split) << '_'
+                  << firstFrame << '-' << lastFrame
+                  << options.trace.substr(split) << '"';
+    }
+    return arguments.str();
+}
+} // namespace options
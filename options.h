@@ -0,0 +1,71 @@
+#pragma once
+
+#include <limits>
+#include <string>
+
+namespace options
+{
+// Where frames are rendered
+enum class Mode
+{
+    screen,
+    files,
+};
+
+// Format of the frames rendered to files
+enum class Format
+{
+    ppm, // One file per frame
+    y4m, // YUV4MPEG2 video stream
+    rgb, // Raw RGB24 video stream
+};
+
+// Command line options
+struct Options
+{
+    Mode mode = Mode::screen;
+    // Frames rendered to files [firstFrame, lastFrame], numbered from 1 like
+    // the output files
+    int firstFrame = 1;
+    int lastFrame = std::numeric_limits<int>::max();
+    // Image size, 0 to use the default size of the mode
+    int width = 0;
+    int height = 0;
+    // Samples per pixel of each frame rendered to files, the maximum when
+    // sampling is adaptive
+    int spp = 20;
+    // Adaptive sampling stops accumulating samples once the estimated
+    // variance of the frame is below this target, 0 to disable it
+    float variance = 0.f;
+    // Minimum samples per pixel with adaptive sampling
+    int minSpp = 4;
+    Format format = Format::ppm;
+    // Prefix of the PPM files, or path of the video stream ("-" for the
+    // standard output). Empty for the default of the format
+    std::string output;
+    // Seed of the spheres random parameters, all the processes rendering
+    // parts of the same sequence must use the same one. Without --seed, the
+    // window draws a random one and files are rendered with this default
+    unsigned int seed = 0;
+    bool hasSeed = false;
+    // Number of processes the frames rendered to files are split over
+    int workers = 0;
+    // Render all the PPM files again, instead of resuming from the ones
+    // complete
+    bool restart = false;
+    // File the time spent in each stage of the frames is traced to, as CSV or
+    // as a Chrome trace if it ends with ".json". Empty to disable tracing
+    std::string trace;
+};
+
+// Parse the command line, OSPRay options must have been removed already.
+// Returns false if it is not valid
+bool parse(int argc, const char **argv, Options &options);
+
+// Print command line usage
+void printUsage(const char *program);
+
+// Command line arguments rendering the given frames with the same options
+std::string workerArguments(const Options &options, int firstFrame,
+                            int lastFrame);
+} // namespace options
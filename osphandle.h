@@ -0,0 +1,57 @@
+#pragma once
+
+#include "ospray/ospray.h"
+
+// Owns a reference to an OSPRay object, which is released with the handle.
+// OSPRay keeps its own references to the objects set as parameters, so they
+// can be released as soon as they are set
+template <typename T>
+class OSPHandle
+{
+public:
+    OSPHandle() = default;
+    explicit OSPHandle(T object)
+        : _object(object)
+    {
+    }
+    ~OSPHandle() { reset(); }
+
+    OSPHandle(OSPHandle &&other) noexcept
+        : _object(other.release())
+    {
+    }
+    OSPHandle &operator=(OSPHandle &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset(other.release());
+        }
+        return *this;
+    }
+    OSPHandle(const OSPHandle &) = delete;
+    OSPHandle &operator=(const OSPHandle &) = delete;
+
+    T get() const { return _object; }
+    explicit operator bool() const { return _object != nullptr; }
+
+    // Release the previous object, if any, and own the given one
+    void reset(T object = nullptr)
+    {
+        if (_object != nullptr)
+        {
+            ospRelease(_object);
+        }
+        _object = object;
+    }
+
+    // Give up the ownership of the object without releasing it
+    T release()
+    {
+        T object = _object;
+        _object = nullptr;
+        return object;
+    }
+
+private:
+    T _object = nullptr;
+};
@@ -0,0 +1,137 @@
+#include "osppool.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "ospcommon/AffineSpace.h"
+
+OSPPool::OSPPool(size_t numSharedData)
+    : _maxSharedData(std::max<size_t>(numSharedData, 1))
+{
+    _sharedData.reserve(_maxSharedData);
+}
+
+OSPData OSPPool::getSharedData(size_t count, OSPDataType type,
+                               const void *buffer)
+{
+    ++_numUses;
+    for (auto &shared : _sharedData)
+    {
+        if ((shared.buffer == buffer) && (shared.count == count) &&
+            (shared.type == type))
+        {
+            shared.lastUse = _numUses;
+            ++_numReused;
+            return shared.data.get();
+        }
+    }
+
+    // geometries using the evicted data keep their own reference to it
+    if (_sharedData.size() == _maxSharedData)
+    {
+        const auto oldest = std::min_element(
+            _sharedData.begin(), _sharedData.end(),
+            [](const SharedData &a, const SharedData &b) {
+                return a.lastUse < b.lastUse;
+            });
+        _sharedData.erase(oldest);
+    }
+
+    ++_numCreated;
+    _sharedData.push_back(SharedData{
+        buffer, count, type,
+        OSPHandle<OSPData>(
+            ospNewData(count, type, buffer, OSP_DATA_SHARED_BUFFER)),
+        _numUses});
+    return _sharedData.back().data.get();
+}
+
+OSPHandle<OSPData> OSPPool::newData(size_t count, OSPDataType type,
+                                    const void *buffer)
+{
+    ++_numCreated;
+    return OSPHandle<OSPData>(ospNewData(count, type, buffer, 0));
+}
+
+OSPHandle<OSPGeometry> OSPPool::newGeometry(const char *type)
+{
+    for (auto free = _freeGeometries.rbegin(); free != _freeGeometries.rend();
+         ++free)
+    {
+        if (free->type == type)
+        {
+            ++_numReused;
+            OSPHandle<OSPGeometry> geometry = std::move(free->geometry);
+            _freeGeometries.erase(std::next(free).base());
+            return geometry;
+        }
+    }
+
+    ++_numCreated;
+    return OSPHandle<OSPGeometry>(ospNewGeometry(type));
+}
+
+OSPHandle<OSPGeometry> OSPPool::newInstance(OSPModel model)
+{
+    // ospNewInstance only sets the model and the transform of an instance
+    // geometry, a recycled one is pointed at the new model
+    if (!_freeInstances.empty())
+    {
+        ++_numReused;
+        OSPHandle<OSPGeometry> instance = std::move(_freeInstances.back());
+        _freeInstances.pop_back();
+        ospSetObject(instance.get(), "model", model);
+        return instance;
+    }
+
+    ++_numCreated;
+    const ospcommon::affine3f identity = ospcommon::one;
+    return OSPHandle<OSPGeometry>(ospNewInstance(
+        model, reinterpret_cast<const osp::affine3f &>(identity)));
+}
+
+OSPHandle<OSPModel> OSPPool::newModel()
+{
+    if (!_freeModels.empty())
+    {
+        ++_numReused;
+        OSPHandle<OSPModel> model = std::move(_freeModels.back());
+        _freeModels.pop_back();
+        return model;
+    }
+
+    ++_numCreated;
+    return OSPHandle<OSPModel>(ospNewModel());
+}
+
+OSPHandle<OSPMaterial> OSPPool::newMaterial(const char *renderer,
+                                            const char *type)
+{
+    ++_numCreated;
+    return OSPHandle<OSPMaterial>(ospNewMaterial2(renderer, type));
+}
+
+void OSPPool::recycleGeometry(const char *type,
+                              OSPHandle<OSPGeometry> geometry)
+{
+    if (geometry)
+    {
+        _freeGeometries.push_back(FreeGeometry{type, std::move(geometry)});
+    }
+}
+
+void OSPPool::recycleInstance(OSPHandle<OSPGeometry> instance)
+{
+    if (instance)
+    {
+        _freeInstances.push_back(std::move(instance));
+    }
+}
+
+void OSPPool::recycleModel(OSPHandle<OSPModel> model)
+{
+    if (model)
+    {
+        _freeModels.push_back(std::move(model));
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "osphandle.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Creates OSPRay objects and counts them, so the frames which create objects
+// can be spotted.
+// Geometries, instances and models given back to the pool are kept in free
+// lists by type, and handed out again instead of creating new ones. They keep
+// the parameters they had, callers set the ones they use again.
+// Data objects sharing an application buffer are only views of it, which
+// can't be pointed at another buffer. The pool keeps the latest ones and hands
+// them out again for the same part of the same buffer, instead of creating a
+// new view each time
+class OSPPool
+{
+public:
+    explicit OSPPool(size_t numSharedData = 16);
+
+    // Data object sharing the given buffer, which must outlive it. The pool
+    // owns it, set it as a parameter to keep it
+    OSPData getSharedData(size_t count, OSPDataType type, const void *buffer);
+    // Data object holding a copy of the given buffer
+    OSPHandle<OSPData> newData(size_t count, OSPDataType type,
+                               const void *buffer);
+
+    OSPHandle<OSPGeometry> newGeometry(const char *type);
+    // Instance of a model, with the identity transform. It must be committed
+    // once the model is
+    OSPHandle<OSPGeometry> newInstance(OSPModel model);
+    // Empty model
+    OSPHandle<OSPModel> newModel();
+    OSPHandle<OSPMaterial> newMaterial(const char *renderer, const char *type);
+
+    // Give objects back to the pool. They must not be used anymore, and
+    // models must have been emptied
+    void recycleGeometry(const char *type, OSPHandle<OSPGeometry> geometry);
+    void recycleInstance(OSPHandle<OSPGeometry> instance);
+    void recycleModel(OSPHandle<OSPModel> model);
+
+    // Number of OSPRay objects created so far
+    size_t getNumCreated() const { return _numCreated; }
+    // Number of objects handed out again instead of created
+    size_t getNumReused() const { return _numReused; }
+
+private:
+    struct SharedData
+    {
+        const void *buffer;
+        size_t count;
+        OSPDataType type;
+        OSPHandle<OSPData> data;
+        size_t lastUse; // Least recently used ones are released first
+    };
+
+    struct FreeGeometry
+    {
+        std::string type;
+        OSPHandle<OSPGeometry> geometry;
+    };
+
+    std::vector<SharedData> _sharedData;
+    size_t _maxSharedData;
+    size_t _numUses = 0;
+    std::vector<FreeGeometry> _freeGeometries;
+    std::vector<OSPHandle<OSPGeometry>> _freeInstances;
+    std::vector<OSPHandle<OSPModel>> _freeModels;
+    size_t _numCreated = 0;
+    size_t _numReused = 0;
+};
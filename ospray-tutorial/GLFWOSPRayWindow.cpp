@@ -15,14 +15,71 @@
 // ======================================================================== //
 
 #include "GLFWOSPRayWindow.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <stdexcept>
 
 #include <imgui.h>
 #include "imgui/imgui_impl_glfw_gl3.h"
+#include "ospcommon/tasking/parallel_for.h"
+
+#include "../trace.h"
 
 GLFWOSPRayWindow *GLFWOSPRayWindow::activeWindow = nullptr;
 
+namespace {
+  using Clock = std::chrono::high_resolution_clock;
+
+  float millisecondsSince(Clock::time_point start)
+  {
+    return std::chrono::duration<float, std::milli>(Clock::now() - start)
+        .count();
+  }
+
+  // weight of a new frame in the temporal accumulation history when the
+  // model barely changed, the history holds about 1 / weight frames
+  constexpr float minTemporalWeight = 0.2f;
+  // fraction of the model changing in a frame above which the history is
+  // dropped, the displayed frame would lag too much behind the model
+  constexpr float largeModelChange = 0.75f;
+
+  // frames are rendered in sRGB, but blended in linear space
+  struct SRGBTables
+  {
+    float toLinear[256];
+    uint8_t fromLinear[4096];
+
+    SRGBTables()
+    {
+      for (int i = 0; i < 256; ++i) {
+        const float c = i / 255.f;
+        toLinear[i]   = c <= 0.04045f ? c / 12.92f
+                                      : std::pow((c + 0.055f) / 1.055f, 2.4f);
+      }
+      for (int i = 0; i < 4096; ++i) {
+        const float c = i / 4095.f;
+        const float s = c <= 0.0031308f
+                            ? 12.92f * c
+                            : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+        fromLinear[i] = uint8_t(std::lround(255.f * s));
+      }
+    }
+
+    uint8_t encode(float c) const
+    {
+      return fromLinear[int(std::min(std::max(c, 0.f), 1.f) * 4095.f + 0.5f)];
+    }
+  };
+
+  const SRGBTables &srgbTables()
+  {
+    static const SRGBTables tables;
+    return tables;
+  }
+}  // namespace
+
 GLFWOSPRayWindow::GLFWOSPRayWindow(const ospcommon::vec2i &windowSize,
                                    const ospcommon::box3f &worldBounds,
                                    OSPModel model,
@@ -53,6 +110,10 @@ GLFWOSPRayWindow::GLFWOSPRayWindow(const ospcommon::vec2i &windowSize,
   // make the window's context current
   glfwMakeContextCurrent(glfwWindow);
 
+  // display at the monitor refresh rate, frames are rendered on their own
+  // thread
+  glfwSwapInterval(1);
+
   if (!ImGui_ImplGlfwGL3_Init(glfwWindow, true)) {
       glfwTerminate();
       throw std::runtime_error("Failed to init ImGui!");
@@ -68,6 +129,8 @@ GLFWOSPRayWindow::GLFWOSPRayWindow(const ospcommon::vec2i &windowSize,
   glBindTexture(GL_TEXTURE_2D, framebufferTexture);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  textureStreamer =
+      std::unique_ptr<TextureStreamer>(new TextureStreamer(framebufferTexture));
 
   // set GLFW callbacks
   glfwSetFramebufferSizeCallback(
@@ -136,6 +199,13 @@ GLFWOSPRayWindow::GLFWOSPRayWindow(const ospcommon::vec2i &windowSize,
 
 GLFWOSPRayWindow::~GLFWOSPRayWindow()
 {
+  // the render thread is still running if the main loop was interrupted
+  rendering = false;
+  if (renderThread.joinable())
+    renderThread.join();
+
+  // buffers are deleted while the context exists
+  textureStreamer.reset();
   ImGui_ImplGlfwGL3_Shutdown();
   // cleanly terminate GLFW
   glfwTerminate();
@@ -146,28 +216,74 @@ GLFWOSPRayWindow *GLFWOSPRayWindow::getActiveWindow()
   return activeWindow;
 }
 
+void GLFWOSPRayWindow::post(std::function<void()> message)
+{
+  std::lock_guard<std::mutex> lock(messagesMutex);
+  messages.push_back(std::move(message));
+}
+
 OSPModel GLFWOSPRayWindow::getModel()
 {
   return model;
 }
 
-void GLFWOSPRayWindow::setModel(OSPModel newModel)
+void GLFWOSPRayWindow::setModel(OSPModel newModel, float changedFraction)
 {
-  model = newModel;
+  // the renderer keeps using the same model when only its content changed,
+  // it only needs to be committed again for another one
+  if (newModel != model) {
+    model = newModel;
+
+    // set the model on the renderer
+    ospSetObject(renderer, "model", model);
+    commits.markDirty(renderer, CommitScheduler::Stage::renderer);
+    changedFraction = 1.f;
+  }
 
-  // set the model on the renderer
-  ospSetObject(renderer, "model", model);
+  // OSPRay accumulation restarts, the temporal history only does for large
+  // changes
+  if (changedFraction >= largeModelChange)
+    resetAccumulation();
+  else
+    clearFrameBuffer();
+  pendingChange = std::max(pendingChange, changedFraction);
+}
 
-  // commit the renderer
-  ospCommit(renderer);
+void GLFWOSPRayWindow::clearFrameBuffer()
+{
+  framebufferClearPending = true;
+}
 
-  // clear frame buffer
-  ospFrameBufferClear(framebuffer, OSP_FB_COLOR | OSP_FB_ACCUM);
+void GLFWOSPRayWindow::resetAccumulation()
+{
+  framebufferClearPending = true;
+  historyResetPending     = true;
 }
 
-void GLFWOSPRayWindow::clearFrameBuffer()
+bool GLFWOSPRayWindow::getTemporalAccumulation() const
 {
-  ospFrameBufferClear(framebuffer, OSP_FB_COLOR | OSP_FB_ACCUM);
+  return temporalAccumulation;
+}
+
+void GLFWOSPRayWindow::setTemporalAccumulation(bool enabled)
+{
+  temporalAccumulation = enabled;
+  post([this]() { historyResetPending = true; });
+}
+
+float GLFWOSPRayWindow::getTemporalWeight() const
+{
+  return frames.front().temporalWeight;
+}
+
+CommitScheduler &GLFWOSPRayWindow::getCommitScheduler()
+{
+  return commits;
+}
+
+size_t GLFWOSPRayWindow::getNumCommits() const
+{
+  return frames.front().numCommits;
 }
 
 void GLFWOSPRayWindow::registerDisplayCallback(
@@ -181,8 +297,22 @@ void GLFWOSPRayWindow::registerImGuiCallback(std::function<void()> callback)
   uiCallback = callback;
 }
 
+const GLFWOSPRayWindow::FrameTimes &GLFWOSPRayWindow::getFrameTimes() const
+{
+  return frameTimes;
+}
+
+const char *GLFWOSPRayWindow::getUploadMode() const
+{
+  return TextureStreamer::getModeName(textureStreamer->getMode());
+}
+
 void GLFWOSPRayWindow::mainLoop()
 {
+  // render on a separate thread while this one displays the frames
+  rendering    = true;
+  renderThread = std::thread([this]() { renderLoop(); });
+
   // continue until the user closes the window
   while (!glfwWindowShouldClose(glfwWindow)) {
     display();
@@ -190,21 +320,16 @@ void GLFWOSPRayWindow::mainLoop()
     // poll and process events
     glfwPollEvents();
   }
+
+  // the frame being rendered is finished first
+  rendering = false;
+  renderThread.join();
 }
 
 void GLFWOSPRayWindow::reshape(const ospcommon::vec2i &newWindowSize)
 {
   windowSize = newWindowSize;
 
-  // release the current frame buffer, if it exists
-  if (framebuffer)
-    ospRelease(framebuffer);
-
-  // create new frame buffer
-  framebuffer = ospNewFrameBuffer(*reinterpret_cast<osp::vec2i *>(&windowSize),
-                                  OSP_FB_SRGBA,
-                                  OSP_FB_COLOR | OSP_FB_ACCUM);
-
   // reset OpenGL viewport and orthographic projection
   glViewport(0, 0, windowSize.x, windowSize.y);
 
@@ -215,8 +340,24 @@ void GLFWOSPRayWindow::reshape(const ospcommon::vec2i &newWindowSize)
   // update camera
   arcballCamera->updateWindowSize(windowSize);
 
-  ospSetf(camera, "aspect", windowSize.x / float(windowSize.y));
-  ospCommit(camera);
+  // the render thread switches to a frame buffer of the new size
+  post([this, newWindowSize]() {
+    framebufferSize = newWindowSize;
+
+    // release the current frame buffer, if it exists
+    if (framebuffer)
+      ospRelease(framebuffer);
+
+    // create new frame buffer
+    framebuffer = ospNewFrameBuffer(
+        *reinterpret_cast<const osp::vec2i *>(&framebufferSize),
+        OSP_FB_SRGBA,
+        OSP_FB_COLOR | OSP_FB_ACCUM);
+
+    ospSetf(camera, "aspect", framebufferSize.x / float(framebufferSize.y));
+    commits.markDirty(camera, CommitScheduler::Stage::camera);
+    resetAccumulation();
+  });
 }
 
 void GLFWOSPRayWindow::motion(const ospcommon::vec2f &position)
@@ -250,38 +391,184 @@ void GLFWOSPRayWindow::motion(const ospcommon::vec2f &position)
     }
 
     if (cameraChanged) {
-      ospFrameBufferClear(framebuffer, OSP_FB_COLOR | OSP_FB_ACCUM);
-
-      ospSetf(camera, "aspect", windowSize.x / float(windowSize.y));
-      ospSetVec3f(camera,
-                  "pos",
-                  osp::vec3f{arcballCamera->eyePos().x,
-                             arcballCamera->eyePos().y,
-                             arcballCamera->eyePos().z});
-      ospSetVec3f(camera,
-                  "dir",
-                  osp::vec3f{arcballCamera->lookDir().x,
-                             arcballCamera->lookDir().y,
-                             arcballCamera->lookDir().z});
-      ospSetVec3f(camera,
-                  "up",
-                  osp::vec3f{arcballCamera->upDir().x,
-                             arcballCamera->upDir().y,
-                             arcballCamera->upDir().z});
-
-      ospCommit(camera);
+      // the arcball camera lives on this thread, the render thread gets a
+      // copy of its position
+      const osp::vec3f pos{arcballCamera->eyePos().x,
+                           arcballCamera->eyePos().y,
+                           arcballCamera->eyePos().z};
+      const osp::vec3f dir{arcballCamera->lookDir().x,
+                           arcballCamera->lookDir().y,
+                           arcballCamera->lookDir().z};
+      const osp::vec3f up{arcballCamera->upDir().x,
+                          arcballCamera->upDir().y,
+                          arcballCamera->upDir().z};
+      post([this, pos, dir, up]() {
+        resetAccumulation();
+
+        ospSetVec3f(camera, "pos", pos);
+        ospSetVec3f(camera, "dir", dir);
+        ospSetVec3f(camera, "up", up);
+
+        commits.markDirty(camera, CommitScheduler::Stage::camera);
+      });
     }
   }
 
   previousMouse = mouse;
 }
 
+void GLFWOSPRayWindow::renderLoop()
+{
+  trace::setThreadName("render");
+  while (rendering)
+    renderFrame();
+}
+
+void GLFWOSPRayWindow::runMessages()
+{
+  // messages posted while these ones run wait for the next frame
+  {
+    std::lock_guard<std::mutex> lock(messagesMutex);
+    std::swap(messages, runningMessages);
+  }
+  for (auto &message : runningMessages)
+    message();
+  runningMessages.clear();
+}
+
+void GLFWOSPRayWindow::renderFrame()
+{
+  TRACE_SCOPE("renderFrame");
+
+  // clock used to compute the rendering frame rate
+  static auto frameStart = Clock::now();
+  static size_t numFrames = 0;
+
+  runMessages();
+
+  Frame &frame       = frames.back();
+  FrameTimes &times  = frame.times;
+
+  // if a display callback has been registered, call it
+  if (displayCallback) {
+    TRACE_SCOPE("displayCallback");
+    const auto callbackStart = Clock::now();
+    displayCallback(this);
+    times.callback = millisecondsSince(callbackStart);
+  }
+
+  // commit the objects changed since the previous frame, each of them once,
+  // then restart accumulation if needed
+  const auto commitStart = Clock::now();
+  frame.numCommits       = commits.flush();
+  times.commit           = millisecondsSince(commitStart);
+  if (framebufferClearPending) {
+    ospFrameBufferClear(framebuffer, OSP_FB_COLOR | OSP_FB_ACCUM);
+    framebufferClearPending = false;
+    accumulatedFrames       = 0;
+  }
+  sceneChange   = pendingChange;
+  pendingChange = 0.f;
+
+  // render OSPRay frame
+  {
+    TRACE_SCOPE("ospRenderFrame");
+    const auto renderStart = Clock::now();
+    ospRenderFrame(framebuffer, renderer, OSP_FB_COLOR | OSP_FB_ACCUM);
+    times.render = millisecondsSince(renderStart);
+    ++accumulatedFrames;
+  }
+
+  // map OSPRay frame buffer, blend it into the frame handed to the UI
+  // thread, then unmap
+  {
+    TRACE_SCOPE("readback");
+    const auto readbackStart = Clock::now();
+    const uint32_t *fb =
+        (const uint32_t *)ospMapFrameBuffer(framebuffer, OSP_FB_COLOR);
+    const size_t numPixels = size_t(framebufferSize.x) * framebufferSize.y;
+    uint32_t *pixels       = frame.buffer.mapped;
+    if (frame.buffer.capacity >= numPixels) {
+      std::vector<uint32_t>().swap(frame.pixels);
+    } else {
+      frame.pixels.resize(numPixels);
+      pixels = frame.pixels.data();
+    }
+    frame.size = framebufferSize;
+    accumulate(fb, pixels);
+    frame.data = pixels;
+    ospUnmapFrameBuffer(fb, framebuffer);
+    frame.temporalWeight = temporalWeight;
+    times.readback       = millisecondsSince(readbackStart);
+  }
+
+  auto frameEnd = Clock::now();
+  times.frame =
+      std::chrono::duration<float, std::milli>(frameEnd - frameStart).count();
+  times.index = ++numFrames;
+  frameStart  = frameEnd;
+
+  frames.publish();
+}
+
+void GLFWOSPRayWindow::accumulate(const uint32_t *pixels, uint32_t *blended)
+{
+  TRACE_SCOPE("accumulate");
+  const ospcommon::vec2i size = framebufferSize;
+  const size_t numPixels      = size_t(size.x) * size.y;
+  if (!temporalAccumulation) {
+    temporalWeight = 1.f;
+    std::copy(pixels, pixels + numPixels, blended);
+    return;
+  }
+  if (history.size() != numPixels) {
+    history.assign(numPixels, ospcommon::vec3f(0.f));
+    historyResetPending = true;
+  }
+
+  // the more the model changed, the more the new frame weighs. Once it stops
+  // changing, OSPRay accumulates frames which are better converged than the
+  // history, so they weigh more and more
+  float weight = 1.f;
+  if (!historyResetPending) {
+    const float changeWeight =
+        minTemporalWeight + (1.f - minTemporalWeight) * sceneChange;
+    weight = std::min(
+        1.f, std::max(changeWeight, accumulatedFrames * minTemporalWeight));
+  }
+  historyResetPending = false;
+  temporalWeight      = weight;
+
+  // rows are blended in parallel, by blocks to amortize task overhead
+  const SRGBTables &srgb = srgbTables();
+  const int rowsPerTask  = 16;
+  const int numTasks     = (size.y + rowsPerTask - 1) / rowsPerTask;
+  ospcommon::tasking::parallel_for(numTasks, [&](int task) {
+    const size_t begin = size_t(task) * rowsPerTask * size.x;
+    const size_t end =
+        std::min(begin + size_t(rowsPerTask) * size.x, numPixels);
+    for (size_t i = begin; i < end; ++i) {
+      const uint32_t p = pixels[i];
+      ospcommon::vec3f &h = history[i];
+      h.x += weight * (srgb.toLinear[p & 0xff] - h.x);
+      h.y += weight * (srgb.toLinear[(p >> 8) & 0xff] - h.y);
+      h.z += weight * (srgb.toLinear[(p >> 16) & 0xff] - h.z);
+      blended[i] = uint32_t(srgb.encode(h.x)) |
+                   uint32_t(srgb.encode(h.y)) << 8 |
+                   uint32_t(srgb.encode(h.z)) << 16 | 0xff000000u;
+    }
+  });
+}
+
 void GLFWOSPRayWindow::display()
 {
+  TRACE_SCOPE("display");
+
   // clock used to compute frame rate
-  static auto displayStart = std::chrono::high_resolution_clock::now();
+  static auto displayStart = Clock::now();
 
   if (showUi && uiCallback) {
+    TRACE_SCOPE("ui");
     ImGui_ImplGlfwGL3_NewFrame();
 
     ImGuiWindowFlags flags = ImGuiWindowFlags_AlwaysAutoResize;
@@ -291,30 +578,26 @@ void GLFWOSPRayWindow::display()
     ImGui::End();
   }
 
-  // if a display callback has been registered, call it
-  if (displayCallback) {
-    displayCallback(this);
+  // the buffer of the frame displayed goes back to the render thread with
+  // the next one, once the texture doesn't read it anymore
+  textureStreamer->release(frames.front().buffer);
+
+  // update OpenGL texture with the latest rendered frame, if there is a new
+  // one. Otherwise the previous one is displayed again
+  if (frames.update() && frames.front().data != nullptr) {
+    TRACE_SCOPE("upload");
+    const auto uploadStart = Clock::now();
+    Frame &frame           = frames.front();
+    textureStreamer->upload(frame.buffer, frame.data, frame.size);
+
+    // times of the render thread come with the frame
+    const float swap  = frameTimes.swap;
+    frameTimes        = frame.times;
+    frameTimes.swap   = swap;
+    frameTimes.upload = millisecondsSince(uploadStart);
   }
 
-  // render OSPRay frame
-  ospRenderFrame(framebuffer, renderer, OSP_FB_COLOR | OSP_FB_ACCUM);
-
-  // map OSPRay frame buffer, update OpenGL texture with its contents, then
-  // unmap
-  uint32_t *fb = (uint32_t *)ospMapFrameBuffer(framebuffer, OSP_FB_COLOR);
-
-  glBindTexture(GL_TEXTURE_2D, framebufferTexture);
-  glTexImage2D(GL_TEXTURE_2D,
-               0,
-               GL_RGBA,
-               windowSize.x,
-               windowSize.y,
-               0,
-               GL_RGBA,
-               GL_UNSIGNED_BYTE,
-               fb);
-
-  ospUnmapFrameBuffer(fb, framebuffer);
+  TRACE_SCOPE("draw");
 
   // clear current OpenGL color buffer
   glClear(GL_COLOR_BUFFER_BIT);
@@ -341,19 +624,28 @@ void GLFWOSPRayWindow::display()
   }
 
   // swap buffers
-  glfwSwapBuffers(glfwWindow);
+  {
+    TRACE_SCOPE("glfwSwapBuffers");
+    const auto swapStart = Clock::now();
+    glfwSwapBuffers(glfwWindow);
+    frameTimes.swap = millisecondsSince(swapStart);
+  }
 
-  // display frame rate in window title
-  auto displayEnd = std::chrono::high_resolution_clock::now();
-  auto durationMilliseconds =
-      std::chrono::duration_cast<std::chrono::milliseconds>(displayEnd -
-                                                            displayStart);
+  // display frame rates in window title, from the time since the previous
+  // frame. They are not truncated to milliseconds, which made fast frame
+  // rates jump between a few values
+  auto displayEnd = Clock::now();
+  const float displayTime =
+      std::chrono::duration<float, std::milli>(displayEnd - displayStart)
+          .count();
   displayStart = displayEnd;
 
-  const float frameRate = 1000.f / float(durationMilliseconds.count());
+  const float frameRate  = 1000.f / displayTime;
+  const float renderRate = 1000.f / frameTimes.frame;
 
   std::stringstream windowTitle;
-  windowTitle << "OSPRay: " << std::setprecision(3) << frameRate << " fps";
+  windowTitle << "OSPRay: " << std::setprecision(3) << frameRate
+              << " fps (rendering " << renderRate << " fps)";
 
   glfwSetWindowTitle(glfwWindow, windowTitle.str().c_str());
 }
@@ -17,15 +17,40 @@
 #pragma once
 
 #include <GLFW/glfw3.h>
+#include <atomic>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "ArcballCamera.h"
+#include "TextureStreamer.h"
 #include "ospcommon/box.h"
 #include "ospcommon/vec.h"
 #include "ospray/ospray.h"
-
+#include "../commitscheduler.h"
+#include "../triplebuffer.h"
+
+// Frames are rendered on a render thread, which runs the display callback and
+// owns the OSPRay objects. The UI thread polls events, builds the UI and
+// displays the latest rendered frame, so it keeps up with the monitor refresh
+// rate whatever the rendering cost. Changes from the UI thread are posted to
+// the render thread as messages
 class GLFWOSPRayWindow
 {
  public:
+  // durations of the stages of the last rendered frame, in milliseconds
+  struct FrameTimes
+  {
+    float frame    = 0.f;  // time between two rendered frames
+    float callback = 0.f;  // display callback
+    float commit   = 0.f;  // committing the objects changed for the frame
+    float render   = 0.f;  // ospRenderFrame
+    float readback = 0.f;  // mapping, blending and handing the frame to the UI
+    float upload   = 0.f;  // updating the texture, on the UI thread
+    float swap     = 0.f;  // glfwSwapBuffers on the UI thread, waits for vsync
+    size_t index   = 0;    // frames rendered so far
+  };
+
   GLFWOSPRayWindow(const ospcommon::vec2i &windowSize,
                    const ospcommon::box3f &worldBounds,
                    OSPModel model,
@@ -35,23 +60,75 @@ class GLFWOSPRayWindow
 
   static GLFWOSPRayWindow * getActiveWindow();
 
+  // run a function on the render thread before it renders its next frame.
+  // OSPRay objects and the model shown must only be modified from there
+  void post(std::function<void()> message);
+
+  // render thread only
   OSPModel getModel();
-  void setModel(OSPModel newModel);
+  // changedFraction tells how much of the model changed since the previous
+  // frame, small changes keep part of the temporal accumulation history
+  void setModel(OSPModel newModel, float changedFraction = 1.f);
 
+  // render thread only: the frame buffer is cleared before rendering the
+  // next frame
   void clearFrameBuffer();
-
+  // clear the frame buffer and drop the temporal accumulation history
+  void resetAccumulation();
+
+  // displayed frames are an exponential moving average of the rendered ones
+  // while the model changes, instead of restarting from 1 spp at every frame
+  bool getTemporalAccumulation() const;
+  void setTemporalAccumulation(bool enabled);
+  // weight of the last rendered frame in the displayed one, 1 without history
+  float getTemporalWeight() const;
+
+  // render thread only: objects modified between frames are committed
+  // before rendering, the scene's ones included when it schedules them here
+  CommitScheduler &getCommitScheduler();
+  // number of objects committed before rendering the last frame displayed
+  size_t getNumCommits() const;
+
+  // the display callback is called by the render thread before each frame
   void registerDisplayCallback(
       std::function<void(GLFWOSPRayWindow *)> callback);
 
   void registerImGuiCallback(std::function<void()> callback);
 
+  // stage durations of the last frame displayed
+  const FrameTimes &getFrameTimes() const;
+  // how frames are uploaded to the texture
+  const char *getUploadMode() const;
+
   void mainLoop();
 
  protected:
+  // frame handed from the render thread to the UI thread. Its pixels are
+  // written straight into the mapped texture buffer when there is one large
+  // enough, otherwise into client memory
+  struct Frame
+  {
+    TextureStreamer::Buffer buffer;
+    std::vector<uint32_t> pixels;
+    const uint32_t *data = nullptr;
+    ospcommon::vec2i size{0};
+    FrameTimes times;
+    size_t numCommits    = 0;
+    float temporalWeight = 1.f;
+  };
+
   void reshape(const ospcommon::vec2i &newWindowSize);
   void motion(const ospcommon::vec2f &position);
   void display();
 
+  // render thread
+  void renderLoop();
+  void renderFrame();
+  void runMessages();
+  // blend a rendered frame with the temporal accumulation history into the
+  // pixels to display
+  void accumulate(const uint32_t *pixels, uint32_t *blended);
+
   static GLFWOSPRayWindow *activeWindow;
 
   ospcommon::vec2i windowSize;
@@ -62,17 +139,42 @@ class GLFWOSPRayWindow
   // GLFW window instance
   GLFWwindow *glfwWindow = nullptr;
 
-  // Arcball camera instance
+  // Arcball camera instance, on the UI thread
   std::unique_ptr<ArcballCamera> arcballCamera;
 
   // OSPRay objects managed by this class
   OSPCamera camera           = nullptr;
   OSPFrameBuffer framebuffer = nullptr;
-
-  // OpenGL framebuffer texture
+  ospcommon::vec2i framebufferSize{0};
+
+  // render thread and the messages it runs before its next frame
+  std::thread renderThread;
+  std::atomic<bool> rendering{false};
+  std::mutex messagesMutex;
+  std::vector<std::function<void()>> messages;
+  std::vector<std::function<void()>> runningMessages;
+
+  // rendered frames, the UI thread displays the latest one
+  TripleBuffer<Frame> frames;
+
+  // changes waiting for the next frame
+  CommitScheduler commits;
+  bool framebufferClearPending = false;
+
+  // temporal accumulation, in linear color space
+  std::atomic<bool> temporalAccumulation{true};
+  bool historyResetPending  = true;
+  float pendingChange       = 0.f;  // largest model change since last frame
+  float sceneChange         = 0.f;  // model change of the frame being drawn
+  float temporalWeight      = 1.f;
+  int accumulatedFrames     = 0;  // accumulated by OSPRay since last clear
+  std::vector<ospcommon::vec3f> history;
+
+  // OpenGL framebuffer texture, and the uploads to it
   GLuint framebufferTexture = 0;
+  std::unique_ptr<TextureStreamer> textureStreamer;
 
-  // optional registered display callback, called before every display()
+  // optional registered display callback, called before every frame
   std::function<void(GLFWOSPRayWindow *)> displayCallback;
 
   // toggles display of ImGui UI, if an ImGui callback is provided
@@ -80,4 +182,7 @@ class GLFWOSPRayWindow
 
   // optional registered ImGui callback, called during every frame to build UI
   std::function<void()> uiCallback;
+
+  // times of the last frame displayed, on the UI thread
+  FrameTimes frameTimes;
 };
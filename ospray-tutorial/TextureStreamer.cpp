@@ -0,0 +1,278 @@
+#include "TextureStreamer.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include "../trace.h"
+
+// OpenGL buffer functions and constants are not part of the OpenGL 1.1
+// headers, they are loaded at run time
+#ifdef _WIN32
+#define STREAMER_APIENTRY __stdcall
+#else
+#define STREAMER_APIENTRY
+#endif
+
+namespace {
+  constexpr GLenum pixelUnpackBuffer = 0x88EC;  // GL_PIXEL_UNPACK_BUFFER
+  constexpr GLenum streamDraw        = 0x88E0;  // GL_STREAM_DRAW
+  constexpr GLenum syncGPUComplete   = 0x9117;  // GL_SYNC_GPU_COMMANDS_COMPLETE
+  constexpr GLenum timeoutExpired    = 0x911B;  // GL_TIMEOUT_EXPIRED
+  constexpr GLenum versionString     = 0x1F02;  // GL_VERSION
+
+  // GL_MAP_*_BIT
+  constexpr GLbitfield mapWrite      = 0x0002;
+  constexpr GLbitfield mapInvalidate = 0x0008;  // invalidate buffer
+  constexpr GLbitfield mapPersistent = 0x0040;
+  constexpr GLbitfield mapCoherent   = 0x0080;
+  // GL_SYNC_FLUSH_COMMANDS_BIT
+  constexpr GLbitfield syncFlush     = 0x0001;
+
+  constexpr uint64_t fenceTimeout = 100000000;  // 100 ms, in ns
+
+  constexpr size_t ringSize = 3;
+
+  // OpenGL version of the current context, as major * 10 + minor
+  int getVersion()
+  {
+    const char *version = (const char *)glGetString(versionString);
+    int major = 0, minor = 0;
+    if (version == nullptr || sscanf(version, "%d.%d", &major, &minor) != 2)
+      return 0;
+    return major * 10 + minor;
+  }
+
+  template <typename T>
+  bool load(T &function, const char *name)
+  {
+    function = reinterpret_cast<T>(glfwGetProcAddress(name));
+    return function != nullptr;
+  }
+}  // namespace
+
+struct TextureStreamer::Functions
+{
+  void(STREAMER_APIENTRY *genBuffers)(GLsizei, GLuint *);
+  void(STREAMER_APIENTRY *deleteBuffers)(GLsizei, const GLuint *);
+  void(STREAMER_APIENTRY *bindBuffer)(GLenum, GLuint);
+  void(STREAMER_APIENTRY *bufferData)(GLenum, ptrdiff_t, const void *, GLenum);
+  void(STREAMER_APIENTRY *bufferStorage)(GLenum,
+                                         ptrdiff_t,
+                                         const void *,
+                                         GLbitfield);
+  void *(STREAMER_APIENTRY *mapBufferRange)(GLenum,
+                                            ptrdiff_t,
+                                            ptrdiff_t,
+                                            GLbitfield);
+  GLboolean(STREAMER_APIENTRY *unmapBuffer)(GLenum);
+  void *(STREAMER_APIENTRY *fenceSync)(GLenum, GLbitfield);
+  GLenum(STREAMER_APIENTRY *clientWaitSync)(void *, GLbitfield, uint64_t);
+  void(STREAMER_APIENTRY *deleteSync)(void *);
+
+  // pixel buffer objects, mapped by range
+  bool loadMapped()
+  {
+    const int version = getVersion();
+    const bool supported =
+        version >= 30 || (version >= 21 &&
+                          glfwExtensionSupported("GL_ARB_map_buffer_range"));
+    return supported && load(genBuffers, "glGenBuffers") &&
+           load(deleteBuffers, "glDeleteBuffers") &&
+           load(bindBuffer, "glBindBuffer") &&
+           load(bufferData, "glBufferData") &&
+           load(mapBufferRange, "glMapBufferRange") &&
+           load(unmapBuffer, "glUnmapBuffer");
+  }
+
+  // immutable storage mapped once, and fences to know when it is read
+  bool loadPersistent()
+  {
+    const int version = getVersion();
+    const bool supported =
+        version >= 44 ||
+        (version >= 32 && glfwExtensionSupported("GL_ARB_buffer_storage"));
+    return supported && load(bufferStorage, "glBufferStorage") &&
+           load(fenceSync, "glFenceSync") &&
+           load(clientWaitSync, "glClientWaitSync") &&
+           load(deleteSync, "glDeleteSync");
+  }
+};
+
+TextureStreamer::TextureStreamer(GLuint texture)
+    : texture(texture), gl(new Functions())
+{
+  if (gl->loadMapped()) {
+    mode = gl->loadPersistent() ? Mode::persistent : Mode::mapped;
+  }
+
+  if (mode == Mode::mapped) {
+    ring.resize(ringSize);
+    gl->genBuffers(GLsizei(ring.size()), ring.data());
+  }
+}
+
+TextureStreamer::~TextureStreamer()
+{
+  // deleting a mapped buffer unmaps it
+  if (!frameBuffers.empty())
+    gl->deleteBuffers(GLsizei(frameBuffers.size()), frameBuffers.data());
+  if (!ring.empty())
+    gl->deleteBuffers(GLsizei(ring.size()), ring.data());
+}
+
+TextureStreamer::Mode TextureStreamer::getMode() const
+{
+  return mode;
+}
+
+const char *TextureStreamer::getModeName(Mode mode)
+{
+  switch (mode) {
+  case Mode::persistent:
+    return "persistent PBO";
+  case Mode::mapped:
+    return "mapped PBO";
+  default:
+    return "direct";
+  }
+}
+
+void TextureStreamer::upload(Buffer &buffer,
+                             const uint32_t *pixels,
+                             const ospcommon::vec2i &size)
+{
+  TRACE_SCOPE("TextureStreamer::upload");
+  const size_t numPixels = size_t(size.x) * size.y;
+  if (numPixels == 0)
+    return;
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  resizeTexture(size);
+
+  if (buffer.mapped != nullptr && pixels == buffer.mapped) {
+    // the frame is already in the buffer, the copy to the texture runs
+    // asynchronously. The fence tells when it is over
+    gl->bindBuffer(pixelUnpackBuffer, buffer.id);
+    glTexSubImage2D(GL_TEXTURE_2D,
+                    0,
+                    0,
+                    0,
+                    size.x,
+                    size.y,
+                    GL_RGBA,
+                    GL_UNSIGNED_BYTE,
+                    nullptr);
+    gl->bindBuffer(pixelUnpackBuffer, 0);
+    buffer.fence = gl->fenceSync(syncGPUComplete, 0);
+    return;
+  }
+
+  if (mode == Mode::mapped) {
+    uploadMapped(pixels, numPixels);
+    return;
+  }
+
+  glTexSubImage2D(GL_TEXTURE_2D,
+                  0,
+                  0,
+                  0,
+                  size.x,
+                  size.y,
+                  GL_RGBA,
+                  GL_UNSIGNED_BYTE,
+                  pixels);
+
+  // the next frame of this size goes straight into a buffer
+  if (mode == Mode::persistent)
+    resizeBuffer(buffer, numPixels);
+}
+
+void TextureStreamer::release(Buffer &buffer)
+{
+  if (buffer.fence == nullptr)
+    return;
+
+  // the copy was issued a frame ago, it is usually over already
+  TRACE_SCOPE("TextureStreamer::release");
+  while (gl->clientWaitSync(buffer.fence, syncFlush, fenceTimeout) ==
+         timeoutExpired) {
+  }
+  gl->deleteSync(buffer.fence);
+  buffer.fence = nullptr;
+}
+
+void TextureStreamer::resizeTexture(const ospcommon::vec2i &size)
+{
+  if (size == textureSize)
+    return;
+
+  glTexImage2D(GL_TEXTURE_2D,
+               0,
+               GL_RGBA,
+               size.x,
+               size.y,
+               0,
+               GL_RGBA,
+               GL_UNSIGNED_BYTE,
+               nullptr);
+  textureSize = size;
+}
+
+void TextureStreamer::resizeBuffer(Buffer &buffer, size_t numPixels)
+{
+  if (buffer.capacity >= numPixels)
+    return;
+
+  // immutable storage can't be resized, the buffer is replaced
+  release(buffer);
+  if (buffer.id != 0) {
+    gl->deleteBuffers(1, &buffer.id);
+    frameBuffers.erase(
+        std::remove(frameBuffers.begin(), frameBuffers.end(), buffer.id),
+        frameBuffers.end());
+  }
+  buffer = Buffer();
+
+  const ptrdiff_t bytes    = ptrdiff_t(numPixels * sizeof(uint32_t));
+  const GLbitfield flags   = mapWrite | mapPersistent | mapCoherent;
+  gl->genBuffers(1, &buffer.id);
+  gl->bindBuffer(pixelUnpackBuffer, buffer.id);
+  gl->bufferStorage(pixelUnpackBuffer, bytes, nullptr, flags);
+  buffer.mapped =
+      (uint32_t *)gl->mapBufferRange(pixelUnpackBuffer, 0, bytes, flags);
+  gl->bindBuffer(pixelUnpackBuffer, 0);
+  frameBuffers.push_back(buffer.id);
+
+  // frames keep being uploaded from client memory if it can't be mapped
+  if (buffer.mapped != nullptr)
+    buffer.capacity = numPixels;
+}
+
+void TextureStreamer::uploadMapped(const uint32_t *pixels, size_t numPixels)
+{
+  const ptrdiff_t bytes = ptrdiff_t(numPixels * sizeof(uint32_t));
+  const GLuint id       = ring[ringIndex];
+  ringIndex             = (ringIndex + 1) % ring.size();
+
+  // new storage is requested each time, so the driver doesn't wait for the
+  // previous upload from this buffer
+  gl->bindBuffer(pixelUnpackBuffer, id);
+  gl->bufferData(pixelUnpackBuffer, bytes, nullptr, streamDraw);
+  void *mapped = gl->mapBufferRange(
+      pixelUnpackBuffer, 0, bytes, mapWrite | mapInvalidate);
+  if (mapped != nullptr) {
+    std::memcpy(mapped, pixels, size_t(bytes));
+    gl->unmapBuffer(pixelUnpackBuffer);
+  }
+  glTexSubImage2D(GL_TEXTURE_2D,
+                  0,
+                  0,
+                  0,
+                  textureSize.x,
+                  textureSize.y,
+                  GL_RGBA,
+                  GL_UNSIGNED_BYTE,
+                  mapped != nullptr ? nullptr : pixels);
+  gl->bindBuffer(pixelUnpackBuffer, 0);
+}
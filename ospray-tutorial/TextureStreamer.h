@@ -0,0 +1,76 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "ospcommon/vec.h"
+
+// Streams frames to an OpenGL texture. Texture storage is only allocated when
+// the frame size changes, frames are uploaded with glTexSubImage2D through
+// pixel buffer objects when the OpenGL implementation supports them:
+//   - persistent: each frame has its own persistently mapped buffer, which
+//     can be written from any thread, so frames are rendered straight into it
+//     and the upload doesn't copy anything on the CPU
+//   - mapped: frames are copied into a ring of buffers mapped at each upload
+//   - direct: frames are uploaded from client memory
+// It must be used on the thread owning the OpenGL context
+class TextureStreamer
+{
+ public:
+  enum class Mode
+  {
+    persistent,
+    mapped,
+    direct
+  };
+
+  // pixel buffer of a frame, only used in persistent mode
+  struct Buffer
+  {
+    GLuint id         = 0;
+    uint32_t *mapped  = nullptr;  // written by the frame producer
+    size_t capacity   = 0;        // in pixels
+    void *fence       = nullptr;  // set while the texture reads the buffer
+  };
+
+  // the OpenGL context must be current
+  explicit TextureStreamer(GLuint texture);
+  ~TextureStreamer();
+
+  TextureStreamer(const TextureStreamer &) = delete;
+  TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+  Mode getMode() const;
+  static const char *getModeName(Mode mode);
+
+  // upload RGBA pixels to the texture. They are either the mapped memory of
+  // the buffer, or client memory, in which case the buffer is resized so the
+  // next frame of that size can be written into it
+  void upload(Buffer &buffer,
+              const uint32_t *pixels,
+              const ospcommon::vec2i &size);
+
+  // wait until the texture doesn't read the buffer anymore, before its frame
+  // is written again
+  void release(Buffer &buffer);
+
+ private:
+  struct Functions;
+
+  void resizeTexture(const ospcommon::vec2i &size);
+  void resizeBuffer(Buffer &buffer, size_t numPixels);
+  void uploadMapped(const uint32_t *pixels, size_t numPixels);
+
+  GLuint texture;
+  ospcommon::vec2i textureSize{0};
+  Mode mode = Mode::direct;
+  std::unique_ptr<Functions> gl;
+
+  // buffers of the frames, in persistent mode
+  std::vector<GLuint> frameBuffers;
+
+  // ring of buffers for the mapped mode
+  std::vector<GLuint> ring;
+  size_t ringIndex = 0;
+};
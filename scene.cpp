@@ -1,29 +1,167 @@
 #include "scene.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <mutex>
+#include <numeric>
 #include <random>
 
 #include "fonts.h"
+#include "ospcommon/tasking/parallel_for.h"
+#include "trace.h"
 #include "utils.h"
 
 using namespace ospcommon;
 
-Scene::Scene()
+namespace
+{
+static_assert(sizeof(vec2f) == 2 * sizeof(float), "vec2f must be packed");
+static_assert(sizeof(vec3f) == 3 * sizeof(float), "vec3f must be packed");
+static_assert(sizeof(vec4f) == 4 * sizeof(float), "vec4f must be packed");
+
+// View an array of vectors as floats for the animation kernels
+template <typename T>
+float *floats(std::vector<T> &v)
+{
+    return reinterpret_cast<float *>(v.data());
+}
+
+template <typename T>
+const float *floats(const std::vector<T> &v)
+{
+    return reinterpret_cast<const float *>(v.data());
+}
+
+// Reorder an array in place, element i is replaced by element order[i]
+template <typename T>
+void reorder(std::vector<T> &v, const std::vector<size_t> &order)
+{
+    assert(v.size() == order.size());
+    std::vector<T> reordered;
+    reordered.reserve(v.size());
+    for (size_t i : order)
+    {
+        reordered.push_back(v[i]);
+    }
+    std::copy(reordered.begin(), reordered.end(), v.begin());
+}
+
+// Minimum number of spheres kept in the dynamic model around the moving ones
+constexpr size_t minPartitionMargin = 1024;
+
+// Width of the widest vector kernels
+constexpr size_t kernelsWidth = 16;
+
+// Number of spheres processed by each task, a multiple of the widest vector
+// kernels so only the last chunk needs a scalar tail
+constexpr size_t spheresPerTask = 1024 * kernelsWidth;
+
+// Split spheres [begin, end[ into fixed size chunks processed in parallel by
+// OSPRay tasking system, and tell if any chunk was updated.
+// Chunks don't depend on the number of threads so results are deterministic
+template <typename Kernel>
+bool parallelForSpheres(size_t begin, size_t end, const Kernel &kernel)
+{
+    if (end <= begin)
+    {
+        return false;
+    }
+
+    const size_t numTasks = (end - begin + spheresPerTask - 1) / spheresPerTask;
+    if (numTasks == 1)
+    {
+        return kernel(begin, end);
+    }
+
+    std::atomic<bool> updated{false};
+    ospcommon::tasking::parallel_for(numTasks, [&](size_t taskIndex) {
+        const size_t taskBegin = begin + taskIndex * spheresPerTask;
+        const size_t taskEnd = std::min(taskBegin + spheresPerTask, end);
+        if (kernel(taskBegin, taskEnd))
+        {
+            updated.store(true, std::memory_order_relaxed);
+        }
+    });
+    return updated.load();
+}
+
+// Wave width and speed, relative to the extent of the spheres along x
+constexpr float waveWidth = 0.5f;
+constexpr float waveSpeed = 1.f;
+
+// Tell if a sphere is still visible during the fade out
+bool isVisible(float tRel, float fadeOffDuration)
+{
+    return std::max(0.f, 1.f - tRel / fadeOffDuration) > 0.f;
+}
+} // namespace
+
+struct Scene::StaticResources
+{
+    OSPHandle<OSPMaterial> spheresMaterial;
+    OSPHandle<OSPGeometry> background;
+};
+
+Scene::Scene(unsigned int seed, const std::string &text)
+    : _seed(seed)
+    , _text(text)
 {
     // Create everything!
     createWorld();
 }
 
-Scene::~Scene()
+unsigned int Scene::randomSeed()
 {
-    ospRelease(_spheresGeometry);
-    ospRelease(_world);
+    return std::random_device{}();
+}
+
+std::shared_ptr<const Scene::StaticResources> Scene::getStaticResources(
+    OSPPool &pool)
+{
+    // only kept alive by the scenes, so they are released with the last one,
+    // before OSPRay is shut down
+    static std::mutex mutex;
+    static std::weak_ptr<const StaticResources> shared;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto resources = shared.lock())
+    {
+        return resources;
+    }
+
+    auto resources = std::make_shared<StaticResources>();
+
+    // alloy material shared by all the spheres geometries
+    resources->spheresMaterial = pool.newMaterial("pathtracer", "Alloy");
+    ospCommit(resources->spheresMaterial.get());
+
+    resources->background = createBackgroundGeometry(pool);
+
+    shared = resources;
+    return resources;
+}
+
+void Scene::Spheres::reorder(const std::vector<size_t> &order)
+{
+    ::reorder(geometry, order);
+    ::reorder(colors, order);
+    ::reorder(maxHeight, order);
+    ::reorder(velocity, order);
+    ::reorder(endPos, order);
+    ::reorder(refRadius, order);
+    ::reorder(fadeOffDuration, order);
+    if (!bouncePeriod.empty())
+    {
+        ::reorder(bouncePeriod, order);
+        ::reorder(bounceSpeed, order);
+    }
 }
 
 void Scene::generateSpheres(std::string text)
 {
-    assert(_spheres.empty());
+    assert(_spheres.size() == 0);
 
     const float letterSize = 0.2f;
     const float lineHeight = 0.3f;
@@ -35,397 +173,780 @@ void Scene::generateSpheres(std::string text)
     const float destZ = 0;
 
     // Create random number distributions
-    std::random_device rd{};
-    std::mt19937 gen{rd()};
+    std::mt19937 gen{_seed};
     std::uniform_real_distribution<float> xVelocityDistribution{-0.2f, 0.2f};
     std::uniform_real_distribution<float> zVelocityDistribution{0.8f, 1.2f};
     std::uniform_real_distribution<float> fadeOffSpeedDistribution{0.2f, 1.f};
 
     // Render text and create a sphere for each pixel
     fonts::renderText(text, [&](float x, float y) {
-        auto &s = _spheres.emplace_back(); // C++ 17 required
-        s.radius = s.refRadius = sphereRadius;
+        auto &g = _spheres.geometry.emplace_back(); // C++ 17 required
+        g.radius = sphereRadius;
+        _spheres.refRadius.push_back(sphereRadius);
 
         // Position
         float yFract, yInt;
         yFract = std::modff(y, &yInt);
-        s.center.x = destX + letterSize * x;
-        s.center.y = destY - letterSize * yFract - lineHeight * yInt;
-        s.center.z = destZ;
+        g.center.x = destX + letterSize * x;
+        g.center.y = destY - letterSize * yFract - lineHeight * yInt;
+        g.center.z = destZ;
 
         // Animation data
-        s.maxHeight = s.center.y;
-        s.endPos = s.center;
-        s.fadeOffDuration = fadeOffSpeedDistribution(gen);
-        s.velocity.x = xVelocityDistribution(gen);
-        s.velocity.y = -zVelocityDistribution(gen);
+        _spheres.maxHeight.push_back(g.center.y);
+        _spheres.endPos.push_back(g.center);
+        _spheres.fadeOffDuration.push_back(fadeOffSpeedDistribution(gen));
+        const float vx = xVelocityDistribution(gen);
+        const float vz = -zVelocityDistribution(gen);
+        _spheres.velocity.push_back(vec2f{vx, vz});
     });
 
     // Once we have all the spheres, set their colors to do a rainbow
-    float i = 0;
-    for (auto &s : _spheres)
+    const size_t numSpheres = _spheres.size();
+    _spheres.colors.resize(numSpheres);
+    for (size_t i = 0; i < numSpheres; ++i)
     {
-        auto rgb = utils::hsl2RGB(180 * i / _spheres.size(), 1, 0.5f);
-        s.color.x = rgb.x;
-        s.color.y = rgb.y;
-        s.color.z = rgb.z;
-        s.color.w = 1;
-        ++i;
+        auto rgb = utils::hsl2RGB(180.f * i / numSpheres, 1, 0.5f);
+        _spheres.colors[i] = vec4f{rgb.x, rgb.y, rgb.z, 1.f};
     }
+
+    // Sort spheres along x, so the wave only has to go through the spheres
+    // it is currently passing over
+    std::vector<size_t> order(numSpheres);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return _spheres.endPos[a].x < _spheres.endPos[b].x;
+    });
+    _spheres.reorder(order);
 }
 
 void Scene::computeAnimations()
 {
-    const int numFrames = 150;
     const float g = 9.81f;
+    const size_t numSpheres = _spheres.size();
 
-    for (auto &s : _spheres)
-    {
-        // Allocate memory for the all the frames
-        s.positions.resize(numFrames);
+    _spheres.bouncePeriod.resize(numSpheres);
+    _spheres.bounceSpeed.resize(numSpheres);
 
-        // Move the sphere away and store each position, the animation will be
-        // played backward
-        float t = 0;
-        vec3f pos = s.center;
-        for (auto rit = s.positions.rbegin(); rit != s.positions.rend(); ++rit)
+    // The bounce is analytic, only its parameters are needed to evaluate the
+    // position of a sphere at any playback frame
+    parallelForSpheres(0, numSpheres, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
         {
-            const float maxHeight = 1 + s.maxHeight;
-            const float T = sqrtf(8.f * maxHeight / g);
-            const float Vmax = sqrtf(2.f * maxHeight * g);
-            const float tRemainder = std::fmodf(0.5f * T + t, T);
+            const float maxHeight = 1 + _spheres.maxHeight[i];
+            _spheres.bouncePeriod[i] = sqrtf(8.f * maxHeight / g);
+            _spheres.bounceSpeed[i] = sqrtf(2.f * maxHeight * g);
+        }
+        return true;
+    });
+}
 
-            pos.y = -1.f + s.radius - 0.5f * g * tRemainder * tRemainder +
-                    Vmax * tRemainder;
+void Scene::AnimState::init(const Spheres &spheres, float deltaTime)
+{
+    _deltaTime = deltaTime;
+    const size_t numSpheres = spheres.size();
+
+    // Spheres are sorted along x
+    if (numSpheres > 0)
+    {
+        _waveX0 = spheres.endPos.front().x;
+        _waveX1 = spheres.endPos.back().x;
+    }
 
-            // Add some side movements
-            pos.x += _deltaTime * s.velocity.x;
-            pos.z += _deltaTime * s.velocity.y;
+    // The last playback frame puts the spheres at their final position
+    _phaseStart[int(AnimPhase::playback)] = 0;
+    _phaseStart[int(AnimPhase::wave)] = _numPlaybackFrames + 1;
 
-            // Store result
-            *rit = pos;
-            t += _deltaTime;
+    // The wave is over on the first frame with no sphere under it
+    int frame = _phaseStart[int(AnimPhase::wave)];
+    _waveBegin = _waveEnd = 0;
+    for (;; ++frame)
+    {
+        moveWave(spheres, phaseTime(AnimPhase::wave, frame));
+        if (_waveBegin == _waveEnd)
+        {
+            break;
         }
     }
+    _waveBegin = _waveEnd = 0;
+    _phaseStart[int(AnimPhase::delay)] = frame + 1;
+
+    // Wait for a second, spheres are sorted for the fade out on the last frame
+    frame = _phaseStart[int(AnimPhase::delay)];
+    while (phaseTime(AnimPhase::delay, frame) < 1.f)
+    {
+        ++frame;
+    }
+    _phaseStart[int(AnimPhase::fadeOut)] = frame + 1;
+
+    // The fade out is over on the first frame with no visible sphere, the
+    // sphere with the longest fade out duration being the last one
+    const float maxFadeOffDuration =
+        numSpheres > 0 ? *std::max_element(spheres.fadeOffDuration.begin(),
+                                           spheres.fadeOffDuration.end())
+                       : 0.f;
+    frame = _phaseStart[int(AnimPhase::fadeOut)];
+    while (isVisible(phaseTime(AnimPhase::fadeOut, frame), maxFadeOffDuration))
+    {
+        ++frame;
+    }
+    _phaseStart[int(AnimPhase::done)] = frame + 1;
 }
 
-bool Scene::AnimState::operator()(std::vector<Sphere> &spheres,
-                                  const float deltaTime)
+const char *Scene::phaseName(AnimPhase phase)
 {
-    bool done = false;
-
-    // Play animation for the current phase, and move to next phase when current
-    // phase is done
     switch (phase)
     {
     case AnimPhase::playback:
+        return "playback";
+    case AnimPhase::wave:
+        return "wave";
+    case AnimPhase::delay:
+        return "delay";
+    case AnimPhase::fadeOut:
+        return "fade out";
+    default:
+        return "done";
+    }
+}
+
+Scene::AnimPhase Scene::AnimState::phaseAt(int frame) const
+{
+    for (int phase = int(AnimPhase::done); phase > 0; --phase)
     {
-        if (!doPlayback(spheres))
+        if (frame >= _phaseStart[phase])
         {
-            phase = AnimPhase::wave;
-            _t0 = _t + deltaTime;
+            return AnimPhase(phase);
         }
     }
-    break;
+    return AnimPhase::playback;
+}
+
+float Scene::AnimState::phaseTime(AnimPhase phase, int frame) const
+{
+    // Time is computed from the frame index rather than accumulated, so it
+    // doesn't depend on the frames played before
+    return float(frame - _phaseStart[int(phase)]) * _deltaTime;
+}
+
+bool Scene::AnimState::operator()(Spheres &spheres)
+{
+    _dirtyRanges.clear();
+
+    // Stay on the last frame once the animation is over
+    if (_frame + 1 >= getNumFrames())
+    {
+        return false;
+    }
+
+    // Play animation for the phase of the next frame
+    const int frame = ++_frame;
+    switch (phaseAt(frame))
+    {
+    case AnimPhase::playback:
+        doPlayback(spheres, frame);
+        break;
 
     case AnimPhase::wave:
-        if (!doWave(spheres))
-        {
-            phase = AnimPhase::delay;
-            _t0 = _t + deltaTime;
-        }
+        doWave(spheres, frame);
         break;
 
     case AnimPhase::delay:
-    {
-        if ((_t - _t0) >= 1)
-        {
-            phase = AnimPhase::fadeOut;
-            _t0 = _t + deltaTime;
-        }
-    }
-    break;
+        break;
+
     case AnimPhase::fadeOut:
-    {
-        if (!doFadeOut(spheres))
+        // Spheres are sorted along with the first fade out update, so the last
+        // frame of the delay doesn't count as a change
+        if (frame == _phaseStart[int(AnimPhase::fadeOut)])
         {
-            phase = AnimPhase::done;
+            startFadeOut(spheres);
         }
-    }
-    break;
+        doFadeOut(spheres, frame);
+        break;
 
-    // Done
     default:
         assert(false);
-    case AnimPhase::done:
-        done = true;
         break;
     }
 
-    // Increment time
-    _t += deltaTime;
-
-    return !done;
+    return true;
 }
 
-bool Scene::AnimState::doPlayback(std::vector<Sphere> &spheres)
+void Scene::AnimState::seek(Spheres &spheres, int frame)
 {
-    bool updated = false;
-    for (auto &s : spheres)
-    {
-        if (_playbackIndex < s.positions.size())
-        {
-            s.center = s.positions[_playbackIndex];
-            updated = true;
-        }
-        else
+    frame = std::max(-1, std::min(frame, getNumFrames() - 1));
+    const size_t numSpheres = spheres.size();
+
+    // Ranges of the previous frame would be merged with the ones marked while
+    // replaying the phases
+    _dirtyRanges.clear();
+
+    // Start over from the spheres sorted along x at their final position,
+    // which is also their state before the first frame
+    restoreOrder(spheres);
+    parallelForSpheres(0, numSpheres, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
         {
-            s.center = s.endPos;
+            spheres.geometry[i].center = spheres.endPos[i];
+            spheres.geometry[i].radius = spheres.refRadius[i];
         }
-    }
+        return true;
+    });
+    _waveBegin = _waveEnd = 0;
+    _visibleEnd = std::numeric_limits<size_t>::max();
 
-    ++_playbackIndex;
+    // Then replay the effect of each phase up to the frame
+    _frame = frame;
+    const AnimPhase phase = phaseAt(frame);
+    if ((phase == AnimPhase::playback) && (frame >= 0))
+    {
+        doPlayback(spheres, frame);
+    }
+    if (phase >= AnimPhase::wave)
+    {
+        seekWave(spheres,
+                 std::min(frame, _phaseStart[int(AnimPhase::delay)] - 1));
+    }
+    if (phase == AnimPhase::fadeOut)
+    {
+        startFadeOut(spheres);
+        doFadeOut(spheres, frame);
+    }
 
-    return updated;
+    // Any sphere may have changed
+    _dirtyRanges.clear();
+    markDirty(0, numSpheres);
 }
 
-bool Scene::AnimState::doWave(std::vector<Sphere> &spheres)
+void Scene::AnimState::doPlayback(Spheres &spheres, int frame)
 {
-    bool updated = false;
+    const size_t numSpheres = spheres.size();
+    markDirty(0, numSpheres);
 
-    if ((_waveX0 == _waveX1) && (!spheres.empty()))
+    if (frame >= _numPlaybackFrames)
     {
-        _waveX0 = spheres.front().center.x;
-        _waveX1 = spheres.back().center.x;
+        parallelForSpheres(0, numSpheres, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                spheres.geometry[i].center = spheres.endPos[i];
+            }
+            return true;
+        });
+        return;
     }
 
-    float tRel = _t - _t0;
+    // The animation is played backward: playback frame i shows the sphere
+    // after (_numPlaybackFrames - i) steps away from its final position.
+    // Times and positions are accumulated step by step, exactly like the
+    // animation was originally baked
+    const int steps = _numPlaybackFrames - frame;
+    float t = 0;
+    for (int step = 1; step < steps; ++step)
+    {
+        t += _deltaTime;
+    }
+
+    animkernels::PlaybackArgs args{};
+    args.geometry = floats(spheres.geometry);
+    args.endPos = floats(spheres.endPos);
+    args.velocity = floats(spheres.velocity);
+    args.refRadius = spheres.refRadius.data();
+    args.bouncePeriod = spheres.bouncePeriod.data();
+    args.bounceSpeed = spheres.bounceSpeed.data();
+    args.t = t;
+    args.steps = steps;
+    args.deltaTime = _deltaTime;
+
+    parallelForSpheres(0, numSpheres, [&](size_t begin, size_t end) {
+        return animkernels::playback(_isa, args, begin, end);
+    });
+}
 
-    // Make a wave go across the spheres field
-    for (auto &s : spheres)
+void Scene::AnimState::moveWave(const Spheres &spheres, float tRel)
+{
+    // The wave position along the spheres decreases with their x, and
+    // increases with time
+    const size_t numSpheres = spheres.size();
+    const auto waveAt = [&](size_t i) {
+        const float dx = (spheres.endPos[i].x - _waveX0) / (_waveX1 - _waveX0);
+        return tRel * waveSpeed - dx;
+    };
+    while ((_waveEnd < numSpheres) && (waveAt(_waveEnd) >= 0.f))
+    {
+        ++_waveEnd;
+    }
+    while ((_waveBegin < _waveEnd) && (waveAt(_waveBegin) > waveWidth))
     {
-        const float waveWidth = 0.5f;
-        const float waveStrength = 0.05f;
-        const float waveSpeed = 1.f;
-        const float scaleFactor = 2.f;
+        ++_waveBegin;
+    }
+}
 
-        const float dx = (s.center.x - _waveX0) / (_waveX1 - _waveX0);
-        float tWave = tRel * waveSpeed - dx;
+void Scene::AnimState::applyWave(Spheres &spheres, float tRel, size_t begin,
+                                 size_t end)
+{
+    animkernels::WaveArgs args{};
+    args.geometry = floats(spheres.geometry);
+    args.endPos = floats(spheres.endPos);
+    args.refRadius = spheres.refRadius.data();
+    args.tRel = tRel;
+    args.x0 = _waveX0;
+    args.x1 = _waveX1;
+    args.waveWidth = waveWidth;
+    args.waveStrength = 0.05f;
+    args.waveSpeed = waveSpeed;
+    args.scaleFactor = 2.f;
+
+    parallelForSpheres(begin, end, [&](size_t taskBegin, size_t taskEnd) {
+        return animkernels::wave(_isa, args, taskBegin, taskEnd);
+    });
+}
 
-        if ((tWave >= 0.f) && (tWave <= waveWidth))
-        {
-            tWave /= waveWidth;
-            const float wave =
-                1.f + std::sinf(float(std::_Pi) * (2 * tWave - 0.5f));
-            s.center.z = s.endPos.z + waveStrength * wave;
+void Scene::AnimState::doWave(Spheres &spheres, int frame)
+{
+    // Make a wave go across the spheres field, spheres leaving the wave are
+    // not modified anymore
+    const float tRel = phaseTime(AnimPhase::wave, frame);
+    moveWave(spheres, tRel);
+    markDirty(_waveBegin, _waveEnd);
+    applyWave(spheres, tRel, _waveBegin, _waveEnd);
+}
+
+void Scene::AnimState::seekWave(Spheres &spheres, int frame)
+{
+    // Spheres the wave went past keep their state from the last frame they
+    // were under it, which is the frame before the window moved past them.
+    // Each sphere is evaluated once instead of once per frame
+    const int firstFrame = _phaseStart[int(AnimPhase::wave)];
+    for (int f = firstFrame; f <= frame; ++f)
+    {
+        const size_t passedBegin = _waveBegin;
+        moveWave(spheres, phaseTime(AnimPhase::wave, f));
+        applyWave(spheres, phaseTime(AnimPhase::wave, f - 1), passedBegin,
+                  _waveBegin);
+    }
+    applyWave(spheres, phaseTime(AnimPhase::wave, frame), _waveBegin,
+              _waveEnd);
+}
+
+void Scene::AnimState::startFadeOut(Spheres &spheres)
+{
+    // Sort spheres by decreasing fade out duration, so the visible ones are
+    // always at the beginning and faded out ones can be retired from the end
+    const size_t numSpheres = spheres.size();
+    std::vector<size_t> order(numSpheres);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return spheres.fadeOffDuration[a] > spheres.fadeOffDuration[b];
+    });
+    spheres.reorder(order);
+    _fadeOrder = std::move(order);
 
-            const float a = std::max(0.f, (tWave < 0.5f ? tWave : 1.f - tWave));
-            s.radius = s.refRadius * (1.f + scaleFactor * a);
+    _visibleEnd = numSpheres;
+    markDirty(0, numSpheres);
+}
 
-            updated = true;
-        }
+void Scene::AnimState::restoreOrder(Spheres &spheres)
+{
+    if (_fadeOrder.empty())
+    {
+        return;
     }
 
-    return updated;
+    // Invert the fade out order, so spheres are back in the exact same order
+    // even when they share the same x
+    std::vector<size_t> order(_fadeOrder.size());
+    for (size_t i = 0; i < _fadeOrder.size(); ++i)
+    {
+        order[_fadeOrder[i]] = i;
+    }
+    spheres.reorder(order);
+    _fadeOrder.clear();
 }
 
-bool Scene::AnimState::doFadeOut(std::vector<Sphere> &spheres)
+void Scene::AnimState::doFadeOut(Spheres &spheres, int frame)
 {
-    bool updated = false;
+    // Fade out the visible spheres
+    animkernels::FadeOutArgs args{};
+    args.geometry = floats(spheres.geometry);
+    args.refRadius = spheres.refRadius.data();
+    args.fadeOffDuration = spheres.fadeOffDuration.data();
+    args.tRel = phaseTime(AnimPhase::fadeOut, frame);
 
-    float tRel = _t - _t0;
+    markDirty(0, _visibleEnd);
 
-    // Fade out all the spheres
-    for (auto &s : spheres)
+    parallelForSpheres(0, _visibleEnd, [&](size_t begin, size_t end) {
+        return animkernels::fadeOut(_isa, args, begin, end);
+    });
+
+    // Retire spheres which are now faded out
+    while ((_visibleEnd > 0) &&
+           !isVisible(args.tRel, args.fadeOffDuration[_visibleEnd - 1]))
     {
-        float scale = std::max(0.f, 1.f - tRel / s.fadeOffDuration);
-        s.radius = s.refRadius * scale;
-        if (scale > 0.f)
-        {
-            updated = true;
-        }
+        --_visibleEnd;
     }
-
-    return updated;
 }
 
-OSPGeometry Scene::createSpheresGeometry()
+void Scene::AnimState::markDirty(size_t begin, size_t end)
 {
-    generateSpheres("The Blue Brain\nProject is\nmindblowing!");
-    computeAnimations();
+    if (begin >= end)
+    {
+        return;
+    }
 
-    // create a data object with all the sphere information
-    OSPData spheresData = ospNewData(_spheres.size() * sizeof(Sphere),
-                                     OSP_UCHAR, _spheres.data());
+    // Merge with the previous range when they touch
+    if (!_dirtyRanges.empty() && (_dirtyRanges.back().end >= begin))
+    {
+        assert(_dirtyRanges.back().begin <= begin);
+        _dirtyRanges.back().end = std::max(_dirtyRanges.back().end, end);
+    }
+    else
+    {
+        _dirtyRanges.push_back(SphereRange{begin, end});
+    }
+}
+
+void Scene::setSpheresData(OSPGeometry geometry, SphereRange range)
+{
+    // data objects for the packed sphere geometry and colors; the simulation
+    // data never reaches OSPRay. Buffers are shared with OSPRay so the
+    // animation updates them in place, which means they must never be
+    // reallocated from now on. The pool owns the data objects, and hands them
+    // out again when the same spheres are set
+    const size_t numSpheres = range.end - range.begin;
+    ospSetData(geometry, "spheres",
+               _pool.getSharedData(numSpheres, OSP_FLOAT4,
+                                   &_spheres.geometry[range.begin]));
+    ospSetData(geometry, "color",
+               _pool.getSharedData(numSpheres, OSP_FLOAT4,
+                                   &_spheres.colors[range.begin]));
+}
 
+OSPHandle<OSPGeometry> Scene::createSpheresGeometry(SphereRange range)
+{
     // create the sphere geometry, and assign attributes
-    _spheresGeometry = ospNewGeometry("spheres");
+    OSPHandle<OSPGeometry> handle = _pool.newGeometry("spheres");
+    OSPGeometry spheresGeometry = handle.get();
 
-    ospSetData(_spheresGeometry, "spheres", spheresData);
-    ospSet1i(_spheresGeometry, "bytes_per_sphere", int(sizeof(Sphere)));
-    ospSet1i(_spheresGeometry, "offset_center", int(offsetof(Sphere, center)));
-    ospSet1i(_spheresGeometry, "offset_radius", int(offsetof(Sphere, radius)));
+    setSpheresData(spheresGeometry, range);
+    ospSet1i(spheresGeometry, "bytes_per_sphere", int(sizeof(SphereGeometry)));
+    ospSet1i(spheresGeometry, "offset_center",
+             int(offsetof(SphereGeometry, center)));
+    ospSet1i(spheresGeometry, "offset_radius",
+             int(offsetof(SphereGeometry, radius)));
 
-    ospSetData(_spheresGeometry, "color", spheresData);
-    ospSet1i(_spheresGeometry, "color_offset", int(offsetof(Sphere, color)));
-    ospSet1i(_spheresGeometry, "color_format", int(OSP_FLOAT4));
-    ospSet1i(_spheresGeometry, "color_stride", int(sizeof(Sphere)));
+    ospSet1i(spheresGeometry, "color_offset", 0);
+    ospSet1i(spheresGeometry, "color_format", int(OSP_FLOAT4));
+    ospSet1i(spheresGeometry, "color_stride", int(sizeof(vec4f)));
 
-    // create alloy material and assign to geometry
-    OSPMaterial alloyMaterial = ospNewMaterial2("pathtracer", "Alloy");
-    ospCommit(alloyMaterial);
+    // assign the alloy material to geometry
+    ospSetMaterial(spheresGeometry, _resources->spheresMaterial.get());
 
-    ospSetMaterial(_spheresGeometry, alloyMaterial);
+    _commits->markDirty(spheresGeometry, CommitScheduler::Stage::geometry);
 
-    // commit the spheres geometry
-    ospCommit(_spheresGeometry);
+    return handle;
+}
 
-    // release handles we no longer need
-    ospRelease(spheresData);
-    ospRelease(alloyMaterial);
+void Scene::createSpheres()
+{
+    generateSpheres(_text);
+    computeAnimations();
+    _animState.init(_spheres, _deltaTime);
 
-    return _spheresGeometry;
+    // all spheres move at first
+    partitionSpheres(SphereRange{0, _spheres.size()});
 }
 
-OSPGeometry Scene::createBackgroundGeometry()
+void Scene::partitionSpheres(SphereRange dynamicRange)
 {
-    OSPGeometry planeGeometry = ospNewGeometry("quads");
+    assert(_world);
+    OSPModel world = _world.get();
 
-    struct Vertex
+    // empty the previous models and give all their objects back to the pool,
+    // the new partition gets them again
+    for (OSPHandle<OSPGeometry> *instance :
+         {&_staticInstance, &_dynamicInstance})
     {
-        vec3f position;
-        vec3f normal;
-        vec4f color;
-    };
-
-    struct QuadIndex
+        if (*instance)
+        {
+            ospRemoveGeometry(world, instance->get());
+            _commits->discard(instance->get());
+            _pool.recycleInstance(std::move(*instance));
+        }
+    }
+    for (auto &geometry : _staticGeometries)
     {
-        int x;
-        int y;
-        int z;
-        int w;
-    };
-
-    std::vector<Vertex> vertices;
-    std::vector<QuadIndex> quadIndices;
+        ospRemoveGeometry(_staticModel.get(), geometry.get());
+        _commits->discard(geometry.get());
+        _pool.recycleGeometry("spheres", std::move(geometry));
+    }
+    _staticGeometries.clear();
+    if (_dynamicGeometry)
+    {
+        ospRemoveGeometry(_dynamicModel.get(), _dynamicGeometry.get());
+        _commits->discard(_dynamicGeometry.get());
+        _pool.recycleGeometry("spheres", std::move(_dynamicGeometry));
+    }
+    _commits->discard(_staticModel.get());
+    _commits->discard(_dynamicModel.get());
+    _pool.recycleModel(std::move(_staticModel));
+    _pool.recycleModel(std::move(_dynamicModel));
+
+    _dynamicRange = dynamicRange;
+    _partitionEnd = getNumVisibleSpheres();
+    assert(_dynamicRange.end <= _partitionEnd);
+
+    // settled spheres, before and after the moving ones
+    const SphereRange staticRanges[] = {
+        SphereRange{0, dynamicRange.begin},
+        SphereRange{dynamicRange.end, _partitionEnd}};
+    for (const auto &range : staticRanges)
+    {
+        if (range.begin < range.end)
+        {
+            if (!_staticModel)
+            {
+                _staticModel = _pool.newModel();
+            }
+            _staticGeometries.push_back(createSpheresGeometry(range));
+            ospAddGeometry(_staticModel.get(),
+                           _staticGeometries.back().get());
+        }
+    }
+    if (_staticModel)
+    {
+        _staticInstance = _pool.newInstance(_staticModel.get());
+        ospAddGeometry(world, _staticInstance.get());
+        _commits->markDirty(_staticModel.get(), CommitScheduler::Stage::model);
+        _commits->markDirty(_staticInstance.get(),
+                            CommitScheduler::Stage::instance);
+    }
 
-    // ground plane
-    int startingIndex = vertices.size();
+    // moving spheres
+    if (dynamicRange.begin < dynamicRange.end)
+    {
+        _dynamicModel = _pool.newModel();
+        _dynamicGeometry = createSpheresGeometry(dynamicRange);
+        ospAddGeometry(_dynamicModel.get(), _dynamicGeometry.get());
+        _dynamicInstance = _pool.newInstance(_dynamicModel.get());
+        ospAddGeometry(world, _dynamicInstance.get());
+        _commits->markDirty(_dynamicModel.get(), CommitScheduler::Stage::model);
+        _commits->markDirty(_dynamicInstance.get(),
+                            CommitScheduler::Stage::instance);
+    }
+}
 
-    // extent of plane in the (x, y) directions
-    const float planeExtent = 20.f;
+OSPHandle<OSPGeometry> Scene::createBackgroundGeometry(OSPPool &pool)
+{
+    // ground plane, a single quad facing the viewer. Its arrays are copied by
+    // OSPRay
+    const float planeExtent = 20.f; // extent of plane in the (x, y) directions
     const float planeZ = -10;
-
+    const vec3f positions[] = {vec3f{-planeExtent, -planeExtent, planeZ},
+                               vec3f{planeExtent, -planeExtent, planeZ},
+                               vec3f{planeExtent, planeExtent, planeZ},
+                               vec3f{-planeExtent, planeExtent, planeZ}};
     const vec3f back = vec3f{0.f, 0.f, -1.f};
+    const vec3f normals[] = {back, back, back, back};
     const vec4f gray = vec4f{0.05f, 0.05f, 0.05f, 1.f};
+    const vec4f colors[] = {gray, gray, gray, gray};
+    const int quadIndices[] = {0, 1, 2, 3};
 
-    vertices.push_back(
-        Vertex{vec3f{-planeExtent, -planeExtent, planeZ}, back, gray});
-    vertices.push_back(
-        Vertex{vec3f{planeExtent, -planeExtent, planeZ}, back, gray});
-    vertices.push_back(
-        Vertex{vec3f{planeExtent, planeExtent, planeZ}, back, gray});
-    vertices.push_back(
-        Vertex{vec3f{-planeExtent, planeExtent, planeZ}, back, gray});
-
-    quadIndices.push_back(QuadIndex{startingIndex, startingIndex + 1,
-                                    startingIndex + 2, startingIndex + 3});
-
-    // create OSPRay data objects
-    std::vector<vec3f> positionVector;
-    std::vector<vec3f> normalVector;
-    std::vector<vec4f> colorVector;
-
-    std::transform(vertices.begin(), vertices.end(),
-                   std::back_inserter(positionVector),
-                   [](Vertex const &v) { return v.position; });
-    std::transform(vertices.begin(), vertices.end(),
-                   std::back_inserter(normalVector),
-                   [](Vertex const &v) { return v.normal; });
-    std::transform(vertices.begin(), vertices.end(),
-                   std::back_inserter(colorVector),
-                   [](Vertex const &v) { return v.color; });
-
-    OSPData positionData =
-        ospNewData(vertices.size(), OSP_FLOAT3, positionVector.data());
-    OSPData normalData =
-        ospNewData(vertices.size(), OSP_FLOAT3, normalVector.data());
-    OSPData colorData =
-        ospNewData(vertices.size(), OSP_FLOAT4, colorVector.data());
-    OSPData indexData =
-        ospNewData(quadIndices.size(), OSP_INT4, quadIndices.data());
+    OSPHandle<OSPGeometry> planeGeometry = pool.newGeometry("quads");
 
     // set vertex / index data on the geometry
-    ospSetData(planeGeometry, "vertex", positionData);
-    ospSetData(planeGeometry, "vertex.normal", normalData);
-    ospSetData(planeGeometry, "vertex.color", colorData);
-    ospSetData(planeGeometry, "index", indexData);
+    const auto positionData = pool.newData(4, OSP_FLOAT3, positions);
+    const auto normalData = pool.newData(4, OSP_FLOAT3, normals);
+    const auto colorData = pool.newData(4, OSP_FLOAT4, colors);
+    const auto indexData = pool.newData(1, OSP_INT4, quadIndices);
+    ospSetData(planeGeometry.get(), "vertex", positionData.get());
+    ospSetData(planeGeometry.get(), "vertex.normal", normalData.get());
+    ospSetData(planeGeometry.get(), "vertex.color", colorData.get());
+    ospSetData(planeGeometry.get(), "index", indexData.get());
 
     // create and assign a material to the geometry
-    OSPMaterial material = ospNewMaterial2("pathtracer", "OBJMaterial");
-    ospCommit(material);
-
-    ospSetMaterial(planeGeometry, material);
+    const auto material = pool.newMaterial("pathtracer", "OBJMaterial");
+    ospCommit(material.get());
+    ospSetMaterial(planeGeometry.get(), material.get());
 
     // finally, commit the geometry
-    ospCommit(planeGeometry);
-
-    // release handles we no longer need
-    ospRelease(positionData);
-    ospRelease(normalData);
-    ospRelease(colorData);
-    ospRelease(indexData);
-    ospRelease(material);
+    ospCommit(planeGeometry.get());
 
     return planeGeometry;
 }
 
 void Scene::createWorld()
 {
-    assert(_world == nullptr);
+    assert(!_world);
 
     // create the "world" model which will contain all of our geometries
-    _world = ospNewModel();
+    _world = _pool.newModel();
 
-    // add in spheres geometry (100 of them)
-    ospAddGeometry(_world, createSpheresGeometry());
+    // materials and background plane are created by the first scene only
+    _resources = getStaticResources(_pool);
+
+    // add in spheres geometries
+    createSpheres();
 
     // add in background plane geometry
-    ospAddGeometry(_world, createBackgroundGeometry());
+    ospAddGeometry(_world.get(), _resources->background.get());
 
-    // commit the world model
-    ospCommit(_world);
+    // commit the spheres objects, then the world model
+    _commits->markDirty(_world.get(), CommitScheduler::Stage::world);
+    _commits->flush();
 }
 
 void Scene::updateSpheresGeometry()
 {
-    // create new spheres data for the updated center coordinates, and assign to
-    // geometry
-    OSPData spheresData = ospNewData(_spheres.size() * sizeof(Sphere),
-                                     OSP_UCHAR, _spheres.data());
+    TRACE_SCOPE("updateSpheresGeometry");
+    const auto &dirtyRanges = getDirtyRanges();
+    assert(!dirtyRanges.empty());
+    const size_t numVisible = getNumVisibleSpheres();
+
+    // nothing left to render
+    if (numVisible == 0)
+    {
+        partitionSpheres(SphereRange{0, 0});
+        return;
+    }
+
+    // faded out spheres are retired from the end. When they are all dynamic,
+    // which is the case during the fade out, just shrink the dynamic geometry
+    if ((numVisible < _partitionEnd) && (_dynamicRange.end == _partitionEnd) &&
+        (numVisible > _dynamicRange.begin))
+    {
+        _dynamicRange.end = _partitionEnd = numVisible;
+        setSpheresData(_dynamicGeometry.get(), _dynamicRange);
+    }
+
+    SphereRange moving{dirtyRanges.front().begin,
+                       std::min(dirtyRanges.back().end, numVisible)};
+    if (!_partitioning)
+    {
+        moving = SphereRange{0, numVisible};
+    }
+
+    // migrate spheres when some moving ones are static, or when the dynamic
+    // model holds many more spheres than needed. A margin is kept around the
+    // moving spheres so this doesn't happen at every frame
+    const size_t numMoving = moving.end - moving.begin;
+    const size_t margin = std::max(numMoving / 4, minPartitionMargin);
+    const bool allDynamic = (moving.begin >= _dynamicRange.begin) &&
+                            (moving.end <= _dynamicRange.end);
+    const bool tooLarge = (_dynamicRange.end - _dynamicRange.begin) >
+                          2 * (numMoving + 2 * margin);
+    if (!allDynamic || tooLarge || (numVisible != _partitionEnd))
+    {
+        partitionSpheres(SphereRange{
+            moving.begin > margin ? moving.begin - margin : 0,
+            std::min(moving.end + margin, numVisible)});
+        return;
+    }
+
+    // spheres data is shared with OSPRay and was updated in place, so there is
+    // nothing to upload: committing the dynamic geometry, its model and
+    // instance is enough for OSPRay to pick the changes up
+    _commits->markDirty(_dynamicGeometry.get(),
+                        CommitScheduler::Stage::geometry);
+    _commits->markDirty(_dynamicModel.get(), CommitScheduler::Stage::model);
+    _commits->markDirty(_dynamicInstance.get(),
+                        CommitScheduler::Stage::instance);
+}
+
+void Scene::setCommitScheduler(CommitScheduler &commits)
+{
+    // objects changed so far are committed now, the new scheduler only gets
+    // the next changes
+    _ownCommits.flush();
+    _commits = &commits;
+}
+
+size_t Scene::getNumVisibleSpheres() const
+{
+    return std::min(_animState.getVisibleEnd(), _spheres.size());
+}
+
+size_t Scene::getNumDirtySpheres() const
+{
+    size_t numDirty = 0;
+    for (const auto &range : getDirtyRanges())
+    {
+        numDirty += range.end - range.begin;
+    }
+    return numDirty;
+}
 
-    ospSetData(_spheresGeometry, "spheres", spheresData);
+void Scene::setKernelsIsa(animkernels::Isa isa)
+{
+    if (animkernels::isSupported(isa))
+    {
+        _animState.setIsa(isa);
+    }
+}
+
+void Scene::commitChanges()
+{
+    // nothing to commit when no sphere changed, like during the delay phase
+    _commitTime = 0.f;
+    _numCreatedObjects = 0;
+    _numCommits = 0;
+    if (!hasChanged())
+    {
+        return;
+    }
+    ++_version;
 
-    // commit the updated spheres geometry
-    ospCommit(_spheresGeometry);
+    TRACE_SCOPE("Scene::commit");
+    const auto commitStart = std::chrono::high_resolution_clock::now();
+    const size_t numCreated = _pool.getNumCreated();
 
-    // release handles we no longer need
-    ospRelease(spheresData);
+    updateSpheresGeometry();
+
+    // commit the model since the spheres geometry changed, after the objects
+    // it holds. Another scheduler is flushed by its owner
+    _commits->markDirty(_world.get(), CommitScheduler::Stage::world);
+    if (_commits == &_ownCommits)
+    {
+        _numCommits = _commits->flush();
+    }
+    _numCreatedObjects = _pool.getNumCreated() - numCreated;
+
+    const auto commitEnd = std::chrono::high_resolution_clock::now();
+    _commitTime =
+        std::chrono::duration<float, std::milli>(commitEnd - commitStart)
+            .count();
 }
 
 // updates the bouncing spheres' coordinates, geometry, and model
 bool Scene::tick()
 {
-    // update the spheres coordinates and geometry
-    if (_animState(_spheres, _deltaTime))
+    TRACE_SCOPE("Scene::tick");
+
+    // update the spheres coordinates
+    bool animated;
+    {
+        TRACE_SCOPE("animate");
+        animated = _animState(_spheres);
+    }
+    if (!animated)
     {
-        updateSpheresGeometry();
+        return false;
+    }
 
-        // commit the model since the spheres geometry changed
-        ospCommit(_world);
+    commitChanges();
+    return true;
+}
 
-        return true;
+bool Scene::evaluateAt(int frame)
+{
+    if ((frame < 0) || (frame >= getNumFrames()))
+    {
+        return false;
     }
 
-    return false;
+    TRACE_SCOPE("Scene::evaluateAt");
+    {
+        TRACE_SCOPE("seek");
+        _animState.seek(_spheres, frame);
+    }
+    commitChanges();
+    return true;
 }
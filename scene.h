@@ -1,7 +1,13 @@
 #pragma once
 
+#include "animkernels.h"
+#include "commitscheduler.h"
+#include "osppool.h"
 #include "ospcommon/vec.h"
 #include "ospray/ospray.h"
+#include <limits>
+#include <memory>
+#include <string>
 #include <vector>
 
 // Main class holding all the scene geometry and animation data
@@ -19,86 +25,276 @@ class Scene
     using vec4f = ospcommon::vec4f;
 
 public:
-    Scene();
-    ~Scene();
+    // Range of spheres [begin, end[
+    struct SphereRange
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    // The animation goes through these different states
+    enum class AnimPhase
+    {
+        playback,
+        wave,
+        delay,
+        fadeOut,
+        done,
+    };
+    // Name of a phase, for display
+    static const char* phaseName(AnimPhase phase);
+
+    // Text drawn by the spheres, one sphere per pixel of its letters
+    static constexpr const char* defaultText =
+        "The Blue Brain\nProject is\nmindblowing!";
+
+    // Spheres random parameters are drawn from the given seed, so scenes
+    // created with the same one play the exact same animation
+    explicit Scene(unsigned int seed = randomSeed(),
+                   const std::string& text = defaultText);
+
+    // Seed drawn from std::random_device, a different animation each time
+    static unsigned int randomSeed();
 
     // Get OSPRay world
-    OSPModel getWorld() { return _world; }
+    OSPModel getWorld() { return _world.get(); }
+    // Schedule the commits of the world changes in the given scheduler rather
+    // than in the scene's own one. Its owner flushes it, along with its own
+    // objects, before rendering
+    void setCommitScheduler(CommitScheduler& commits);
 
-    // Play next animation frame
+    // Play next animation frame, returns false once the animation is over
     bool tick();
+    // Jump to the given frame without playing the previous ones, returns false
+    // if it is not part of the animation
+    bool evaluateAt(int frame);
+
+    // Total number of frames of the animation
+    int getNumFrames() const { return _animState.getNumFrames(); }
+    // Last frame played or evaluated, -1 before the first one
+    int getFrame() const { return _animState.getFrame(); }
+    // Animation time between two frames, in seconds
+    float getFrameDuration() const { return _deltaTime; }
+    // Phase of the last frame played or evaluated
+    AnimPhase getPhase() const { return _animState.getPhase(); }
+    // First frame of a phase, the number of frames for AnimPhase::done
+    int getPhaseStart(AnimPhase phase) const
+    {
+        return _animState.getPhaseStart(phase);
+    }
+
+    // Spheres modified by the last tick, sorted and not overlapping. The world
+    // was not modified if there are none
+    const std::vector<SphereRange>& getDirtyRanges() const
+    {
+        return _animState.getDirtyRanges();
+    }
+    bool hasChanged() const { return !getDirtyRanges().empty(); }
+    size_t getNumDirtySpheres() const;
+    // Version of the world content, incremented each time it changes. Frames
+    // of the same version render the same image with a static camera
+    size_t getVersion() const { return _version; }
+
+    // Keep settled spheres in a static model, so only the moving ones have
+    // their acceleration structure rebuilt at each frame (on by default)
+    bool getPartitioning() const { return _partitioning; }
+    void setPartitioning(bool enabled) { _partitioning = enabled; }
+    // Spheres currently held by the dynamic model
+    SphereRange getDynamicRange() const { return _dynamicRange; }
+    // Number of spheres drawing the text
+    size_t getNumSpheres() const { return _spheres.size(); }
+    // Number of spheres still rendered, faded out spheres are retired
+    size_t getNumVisibleSpheres() const;
+    // Time spent committing changes during the last tick, in milliseconds.
+    // Only their scheduling when another scheduler is flushed by its owner
+    float getCommitTime() const { return _commitTime; }
+    // OSPRay objects created during the last tick, none as long as the
+    // spheres don't migrate between the static and dynamic models
+    size_t getNumCreatedObjects() const { return _numCreatedObjects; }
+    // OSPRay objects committed during the last tick, each at most once. None
+    // when another scheduler is flushed by its owner
+    size_t getNumCommits() const { return _numCommits; }
+
+    // Instruction set used by the animation kernels. The best one supported
+    // is used by default, scalar kernels being the reference implementation
+    animkernels::Isa getKernelsIsa() const { return _animState.getIsa(); }
+    void setKernelsIsa(animkernels::Isa isa);
 
 private:
-    // Data for each sphere
-    struct Sphere
+    // Benchmarks time the steps of the animation separately
+    friend class SceneBenchmark;
+
+    // Rendering data for each sphere, tightly packed as OSPRay expects it
+    struct SphereGeometry
     {
-        // Rendering
         vec3f center{};
         float radius{};
-        vec4f color{};
+    };
+    static_assert(sizeof(SphereGeometry) == 4 * sizeof(float),
+                  "Sphere geometry must be packed as 4 floats for OSPRay");
+
+    // Data for all the spheres, stored as a structure of arrays so OSPRay
+    // only ever sees the rendering arrays (geometry and colors).
+    // Rendering arrays are shared with OSPRay, they must not be resized once
+    // the geometry is created
+    struct Spheres
+    {
+        // Rendering
+        std::vector<SphereGeometry> geometry;
+        std::vector<vec4f> colors;
 
         // Simulation
-        vec3f speed{};
-        float maxHeight{};
-        vec2f velocity{};
-        vec3f endPos{};
-        float refRadius{};
-        float fadeOffDuration{};
-        std::vector<vec3f> positions{};
+        std::vector<float> maxHeight;
+        std::vector<vec2f> velocity;
+        std::vector<vec3f> endPos;
+        std::vector<float> refRadius;
+        std::vector<float> fadeOffDuration;
+        // Bounce period and vertical speed when touching the ground
+        std::vector<float> bouncePeriod;
+        std::vector<float> bounceSpeed;
+
+        size_t size() const { return geometry.size(); }
+
+        // Reorder all the spheres, sphere i is replaced by sphere order[i].
+        // Arrays are updated in place so shared buffers stay valid
+        void reorder(const std::vector<size_t>& order);
     };
 
+    // OSPRay objects which never change, shared by all the scenes
+    struct StaticResources;
+    static std::shared_ptr<const StaticResources> getStaticResources(
+        OSPPool& pool);
+
     // Generates spheres to display the given text
     void generateSpheres(std::string text);
-    // Compute spheres animations
+    // Compute spheres bounce parameters used by the playback animation
     void computeAnimations();
-    // Creates OSPVRay geometry object for the spheres
-    OSPGeometry createSpheresGeometry();
+    // Creates OSPVRay geometry object for the given spheres
+    OSPHandle<OSPGeometry> createSpheresGeometry(SphereRange range);
+    // Creates the spheres and their OSPRay objects
+    void createSpheres();
+    // Set the spheres data of a geometry
+    void setSpheresData(OSPGeometry geometry, SphereRange range);
+    // Put the given spheres in the dynamic model and all the other visible
+    // ones in the static one
+    void partitionSpheres(SphereRange dynamicRange);
     // Creates OSPVRay geometry object for background
-    OSPGeometry createBackgroundGeometry();
+    static OSPHandle<OSPGeometry> createBackgroundGeometry(OSPPool& pool);
     // Create OSPVRay object holding the scene geometry
     void createWorld();
-    // Commit geometry changes
+    // Schedule the commits of geometry changes
     void updateSpheresGeometry();
+    // Commit the changes of the last animation step, if any
+    void commitChanges();
 
-    // Our list of animated spheres
-    std::vector<Sphere> _spheres;
+    // Our animated spheres
+    Spheres _spheres;
+    unsigned int _seed = 0;
+    std::string _text;
 
     // OSPRay objects
-    OSPGeometry _spheresGeometry;
-    OSPModel _world;
+    // Moving spheres live in a dynamic model rebuilt at each frame, settled
+    // ones in a static model only rebuilt when spheres migrate between the two.
+    // Both models are instanced in the world. Their objects go back to the
+    // pool when spheres migrate, and are reused by the new partition
+    OSPPool _pool;
+    CommitScheduler _ownCommits;
+    CommitScheduler* _commits = &_ownCommits; // Not flushed if not our own
+    std::shared_ptr<const StaticResources> _resources;
+    std::vector<OSPHandle<OSPGeometry>> _staticGeometries;
+    OSPHandle<OSPGeometry> _dynamicGeometry;
+    OSPHandle<OSPModel> _staticModel;
+    OSPHandle<OSPModel> _dynamicModel;
+    OSPHandle<OSPGeometry> _staticInstance;
+    OSPHandle<OSPGeometry> _dynamicInstance;
+    OSPHandle<OSPModel> _world;
+
+    SphereRange _dynamicRange{};
+    size_t _partitionEnd = 0; // Spheres after this one are not rendered
+    bool _partitioning = true;
+    float _commitTime = 0.f;
+    size_t _numCreatedObjects = 0;
+    size_t _numCommits = 0;
+    size_t _version = 0;
 
     //
     // Animation stuff
     //
     const float _deltaTime = 0.025f;
-
-    // The animation goes through these different states
-    enum class AnimPhase
-    {
-        playback,
-        wave,
-        delay,
-        fadeOut,
-        done,
-    };
+    static constexpr int _numPlaybackFrames = 150;
 
     // Store the current state of the spheres animation
-    // It's a simple state machine
+    // It's a simple state machine. Each phase lasts a fixed number of frames,
+    // known as soon as the spheres are generated, so any frame can also be
+    // evaluated directly
     class AnimState
     {
     public:
+        // Compute the frames at which each phase starts
+        void init(const Spheres& spheres, float deltaTime);
+
         // Animate to the next frame
-        bool operator()(std::vector<Sphere>& spheres, const float deltaTime);
+        bool operator()(Spheres& spheres);
+        // Evaluate the given frame without playing the previous ones
+        void seek(Spheres& spheres, int frame);
+
+        // Total number of frames of the animation
+        int getNumFrames() const
+        {
+            return _phaseStart[int(AnimPhase::done)];
+        }
+        int getPhaseStart(AnimPhase phase) const
+        {
+            return _phaseStart[int(phase)];
+        }
+        // Last frame played, -1 before the first one
+        int getFrame() const { return _frame; }
+        AnimPhase getPhase() const
+        {
+            return _frame < 0 ? AnimPhase::playback : phaseAt(_frame);
+        }
+
+        animkernels::Isa getIsa() const { return _isa; }
+        void setIsa(animkernels::Isa isa) { _isa = isa; }
+
+        // Spheres modified by the last frame
+        const std::vector<SphereRange>& getDirtyRanges() const
+        {
+            return _dirtyRanges;
+        }
+
+        // Spheres after this one are faded out
+        size_t getVisibleEnd() const { return _visibleEnd; }
 
     private:
-        bool doPlayback(std::vector<Sphere>& spheres);
-        bool doWave(std::vector<Sphere>& spheres);
-        bool doFadeOut(std::vector<Sphere>& spheres);
-
-        AnimPhase phase = AnimPhase::playback;  // Current animation phase
-        float _t = 0.f;                         // Current time
-        float _t0 = 0.f;                        // Start time of the current phase
-        int _playbackIndex = 0;
+        AnimPhase phaseAt(int frame) const;
+        // Time since the beginning of the phase at the given frame
+        float phaseTime(AnimPhase phase, int frame) const;
+
+        void markDirty(size_t begin, size_t end);
+        void startFadeOut(Spheres& spheres);
+        // Sort spheres back along x if they were sorted for the fade out
+        void restoreOrder(Spheres& spheres);
+
+        void doPlayback(Spheres& spheres, int frame);
+        void doWave(Spheres& spheres, int frame);
+        void doFadeOut(Spheres& spheres, int frame);
+
+        // Slide the window of spheres under the wave to the given time
+        void moveWave(const Spheres& spheres, float tRel);
+        // Apply the wave to the spheres [begin, end[ under it
+        void applyWave(Spheres& spheres, float tRel, size_t begin, size_t end);
+        // Evaluate the wave at the given frame, from the start of the wave
+        void seekWave(Spheres& spheres, int frame);
+
+        float _deltaTime = 0.f;
+        int _phaseStart[int(AnimPhase::done) + 1] = {}; // First frame of phases
+        int _frame = -1;                                // Last frame played
         float _waveX0 = 0.f, _waveX1 = 0.f;
+        size_t _waveBegin = 0, _waveEnd = 0; // Spheres under the wave
+        size_t _visibleEnd = std::numeric_limits<size_t>::max();
+        std::vector<size_t> _fadeOrder; // Empty when spheres are sorted along x
+        animkernels::Isa _isa = animkernels::detectIsa();
+        std::vector<SphereRange> _dirtyRanges;
     } _animState;
 };
\ No newline at end of file
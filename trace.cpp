@@ -0,0 +1,204 @@
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace
+{
+namespace detail
+{
+std::atomic<bool> enabled{false};
+} // namespace detail
+
+namespace
+{
+// events kept per thread, about 16 per frame so the latest 2000 frames
+const size_t ringSize = 1 << 15;
+
+struct Event
+{
+    const char *name;
+    int64_t begin;
+    int64_t end;
+};
+
+// Events of a thread, only written by it
+struct ThreadEvents
+{
+    int id = 0;
+    std::string name;
+    std::vector<Event> ring;
+    std::atomic<size_t> numRecorded{0};
+};
+
+const auto origin = std::chrono::steady_clock::now();
+
+// the events of threads which exited are kept until they are exported
+std::mutex threadsMutex;
+std::vector<std::shared_ptr<ThreadEvents>> threads;
+
+ThreadEvents &getThreadEvents()
+{
+    thread_local const std::shared_ptr<ThreadEvents> events = []() {
+        auto events = std::make_shared<ThreadEvents>();
+        events->ring.resize(ringSize);
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        events->id = int(threads.size());
+        events->name = "thread " + std::to_string(events->id);
+        threads.push_back(events);
+        return events;
+    }();
+    return *events;
+}
+
+// Copy the events of a thread still in its ring, oldest first
+std::vector<Event> getEvents(const ThreadEvents &thread)
+{
+    const size_t numRecorded =
+        thread.numRecorded.load(std::memory_order_acquire);
+    const size_t first = numRecorded > ringSize ? numRecorded - ringSize : 0;
+    std::vector<Event> events;
+    events.reserve(numRecorded - first);
+    for (size_t i = first; i < numRecorded; ++i)
+    {
+        events.push_back(thread.ring[i % ringSize]);
+    }
+    return events;
+}
+
+// Escape a string for JSON, names rarely need it
+std::string escapeJSON(const std::string &text)
+{
+    std::string escaped;
+    for (const char c : text)
+    {
+        if ((c == '"') || (c == '\\'))
+        {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+// Quote a string as a CSV field, so names can hold commas and quotes
+std::string quoteCSV(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (const char c : text)
+    {
+        if (c == '"')
+        {
+            quoted += '"';
+        }
+        quoted += c;
+    }
+    return quoted + '"';
+}
+
+void writeCSV(FILE *file)
+{
+    fputs("thread,name,begin_us,duration_us\n", file);
+    for (const auto &thread : threads)
+    {
+        for (const Event &event : getEvents(*thread))
+        {
+            fprintf(file, "%s,%s,%.3f,%.3f\n",
+                    quoteCSV(thread->name).c_str(),
+                    quoteCSV(event.name).c_str(), event.begin * 1e-3,
+                    (event.end - event.begin) * 1e-3);
+        }
+    }
+}
+
+// Complete events ("X") in microseconds, after the names of the threads
+void writeChromeTrace(FILE *file)
+{
+    fputs("{\"traceEvents\":[\n", file);
+    const char *separator = "";
+    for (const auto &thread : threads)
+    {
+        fprintf(file,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                separator, thread->id, escapeJSON(thread->name).c_str());
+        separator = ",\n";
+    }
+    for (const auto &thread : threads)
+    {
+        for (const Event &event : getEvents(*thread))
+        {
+            fprintf(file,
+                    ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f}",
+                    escapeJSON(event.name).c_str(), thread->id,
+                    event.begin * 1e-3, (event.end - event.begin) * 1e-3);
+        }
+    }
+    fputs("\n]}\n", file);
+}
+} // namespace
+
+void setEnabled(bool enable)
+{
+    detail::enabled.store(enable, std::memory_order_relaxed);
+}
+
+int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - origin)
+        .count();
+}
+
+void record(const char *name, int64_t begin, int64_t end)
+{
+    ThreadEvents &events = getThreadEvents();
+    const size_t index = events.numRecorded.load(std::memory_order_relaxed);
+    events.ring[index % ringSize] = Event{name, begin, end};
+    events.numRecorded.store(index + 1, std::memory_order_release);
+}
+
+void setThreadName(const std::string &name)
+{
+    // threads which never record don't need a ring
+    if (!isEnabled())
+    {
+        return;
+    }
+    ThreadEvents &events = getThreadEvents();
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    events.name = name;
+}
+
+bool write(const std::string &fileName)
+{
+    FILE *file = fopen(fileName.c_str(), "w");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    const std::string json = ".json";
+    const bool chromeTrace =
+        (fileName.size() >= json.size()) &&
+        (fileName.compare(fileName.size() - json.size(), json.size(), json) ==
+         0);
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        if (chromeTrace)
+        {
+            writeChromeTrace(file);
+        }
+        else
+        {
+            writeCSV(file);
+        }
+    }
+    const bool written = !ferror(file);
+    return (fclose(file) == 0) && written;
+}
+} // namespace trace
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Timing of the stages of each frame, to tell where its time goes. Scopes are
+// recorded into a ring buffer per thread, which only keeps the latest events,
+// and exported to CSV or to the Chrome trace event format (chrome://tracing,
+// Perfetto).
+// Tracing is disabled by default, a scope then only costs a relaxed load
+namespace trace
+{
+namespace detail
+{
+extern std::atomic<bool> enabled;
+} // namespace detail
+
+// Start or stop recording events
+void setEnabled(bool enable);
+inline bool isEnabled()
+{
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+// Nanoseconds since the process started
+int64_t now();
+
+// Record an event of the calling thread. The name must outlive the trace,
+// like a string literal
+void record(const char *name, int64_t begin, int64_t end);
+
+// Name the calling thread in the exported traces
+void setThreadName(const std::string &name);
+
+// Write the events recorded so far, as CSV or as a Chrome trace if the file
+// name ends with ".json". Threads should be idle, events recorded while
+// exporting may be missing. Returns false if the file can't be written
+bool write(const std::string &fileName);
+
+// Record the time spent in a scope, use TRACE_SCOPE
+class Scope
+{
+public:
+    explicit Scope(const char *name)
+        : _name(isEnabled() ? name : nullptr)
+        , _begin(_name ? now() : 0)
+    {
+    }
+    ~Scope()
+    {
+        if (_name)
+        {
+            record(_name, _begin, now());
+        }
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    const char *const _name;
+    const int64_t _begin;
+};
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Record the time spent until the end of the current scope
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+
+// Hands values from a writer thread to a reader thread without locking. The
+// writer fills the back buffer then publishes it, the reader takes the latest
+// one published. Neither waits for the other, values published while the
+// reader is busy are skipped
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Buffer filled by the writer, its content is left as it was the last
+    // time it was published
+    T &back() { return _buffers[_back]; }
+    // Make the back buffer the latest one and get another one to fill
+    void publish()
+    {
+        _back = _middle.exchange(_back | freshBit, std::memory_order_acq_rel) &
+                indexMask;
+    }
+
+    // Take the latest buffer published, returns false if none was published
+    // since the previous call
+    bool update()
+    {
+        if ((_middle.load(std::memory_order_relaxed) & freshBit) == 0)
+        {
+            return false;
+        }
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) &
+                 indexMask;
+        return true;
+    }
+    // Buffer read by the reader
+    T &front() { return _buffers[_front]; }
+    const T &front() const { return _buffers[_front]; }
+
+private:
+    // The middle buffer index is flagged when it wasn't read yet
+    static constexpr int indexMask = 3;
+    static constexpr int freshBit = 4;
+
+    T _buffers[3];
+    int _back = 0;
+    std::atomic<int> _middle{1};
+    int _front = 2;
+};
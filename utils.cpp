@@ -1,10 +1,73 @@
 #include "utils.h"
+#include "trace.h"
+#include <cerrno>
 #include <cstdio>
 #include <cmath>
+#include <cstring>
 #include <functional>
+#include <vector>
+
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSSE3
+#else
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
 
 using namespace ospcommon;
 
+namespace
+{
+bool hasSSSE3()
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+void rgbaToRGBRow(const uint8_t *in, uint8_t *out, size_t numPixels)
+{
+    for (size_t x = 0; x < numPixels; x++)
+    {
+        out[3 * x + 0] = in[4 * x + 0];
+        out[3 * x + 1] = in[4 * x + 1];
+        out[3 * x + 2] = in[4 * x + 2];
+    }
+}
+
+// Shuffle 16 pixels at a time: each vector of 4 pixels gives 12 bytes, which
+// are packed into 3 full vectors
+TARGET_SSSE3 void rgbaToRGBRowSSSE3(const uint8_t *in, uint8_t *out,
+                                    size_t numPixels)
+{
+    const __m128i dropAlpha =
+        _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    size_t x = 0;
+    for (; x + 16 <= numPixels; x += 16)
+    {
+        const __m128i *src = reinterpret_cast<const __m128i *>(in + 4 * x);
+        const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(src + 0), dropAlpha);
+        const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(src + 1), dropAlpha);
+        const __m128i c = _mm_shuffle_epi8(_mm_loadu_si128(src + 2), dropAlpha);
+        const __m128i d = _mm_shuffle_epi8(_mm_loadu_si128(src + 3), dropAlpha);
+
+        __m128i *dst = reinterpret_cast<__m128i *>(out + 3 * x);
+        _mm_storeu_si128(dst + 0, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128(dst + 1, _mm_or_si128(_mm_srli_si128(b, 4),
+                                               _mm_slli_si128(c, 8)));
+        _mm_storeu_si128(dst + 2, _mm_or_si128(_mm_srli_si128(c, 8),
+                                               _mm_slli_si128(d, 4)));
+    }
+    rgbaToRGBRow(in + 4 * x, out + 3 * x, numPixels - x);
+}
+} // namespace
+
 namespace utils
 {
 // https://stackoverflow.com/a/54014428
@@ -20,32 +83,59 @@ vec3f hsl2RGB(float h, float s, float l)
     return {f(0), f(8), f(4)};
 }
 
+void rgbaToRGB(const vec2i &size, const uint32_t *pixel, uint8_t *rgb)
+{
+    static const bool ssse3 = hasSSSE3();
+    const size_t width = size.x;
+    for (int y = 0; y < size.y; y++)
+    {
+        const uint8_t *in =
+            reinterpret_cast<const uint8_t *>(&pixel[(size.y - 1 - y) * width]);
+        uint8_t *out = &rgb[3 * width * y];
+        if (ssse3)
+        {
+            rgbaToRGBRowSSSE3(in, out, width);
+        }
+        else
+        {
+            rgbaToRGBRow(in, out, width);
+        }
+    }
+}
+
 // helper function to write the rendered image as PPM file
 // (from OSPRay tutorials)
-void writePPM(const char *fileName, const vec2i &size, const uint32_t *pixel)
+bool writePPM(const char *fileName, const vec2i &size, const uint32_t *pixel)
 {
+    TRACE_SCOPE("writePPM");
+
+    // the whole file is built in a buffer reused by the following frames, and
+    // written at once
+    char header[64];
+    const int headerSize =
+        snprintf(header, sizeof(header), "P6\n%i %i\n255\n", size.x, size.y);
+    thread_local std::vector<uint8_t> buffer;
+    buffer.resize(headerSize + 3 * size_t(size.x) * size.y + 1);
+    std::memcpy(buffer.data(), header, headerSize);
+    rgbaToRGB(size, pixel, &buffer[headerSize]);
+    buffer.back() = '\n';
+
     FILE *file = fopen(fileName, "wb");
     if (file == nullptr)
     {
-        fprintf(stderr, "fopen('%s', 'wb') failed: %d", fileName, errno);
-        return;
+        fprintf(stderr, "fopen('%s', 'wb') failed: %d\n", fileName, errno);
+        return false;
     }
-    fprintf(file, "P6\n%i %i\n255\n", size.x, size.y);
-    unsigned char *out = (unsigned char *)alloca(3 * size.x);
-    for (int y = 0; y < size.y; y++)
+    // no need for stdio buffering, the buffer goes straight to the file
+    setvbuf(file, nullptr, _IONBF, 0);
+    bool written =
+        fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    written = (fclose(file) == 0) && written;
+    if (!written)
     {
-        const unsigned char *in =
-            (const unsigned char *)&pixel[(size.y - 1 - y) * size.x];
-        for (int x = 0; x < size.x; x++)
-        {
-            out[3 * x + 0] = in[4 * x + 0];
-            out[3 * x + 1] = in[4 * x + 1];
-            out[3 * x + 2] = in[4 * x + 2];
-        }
-        fwrite(out, 3 * size.x, sizeof(char), file);
+        fprintf(stderr, "Writing '%s' failed: %d\n", fileName, errno);
     }
-    fprintf(file, "\n");
-    fclose(file);
+    return written;
 }
 
 } // namespace utils
\ No newline at end of file
@@ -7,7 +7,12 @@ namespace utils
 // Convert colors from HSL space to RGB
 ospcommon::vec3f hsl2RGB(float h, float s, float l);
 
-// Write frame of pixels into a file
-void writePPM(const char *fileName, const ospcommon::vec2i &size,
+// Convert a frame of RGBA pixels to packed RGB. Rows are flipped since OSPRay
+// frame buffers start with the bottom row
+void rgbaToRGB(const ospcommon::vec2i &size, const uint32_t *pixel,
+               uint8_t *rgb);
+
+// Write frame of pixels into a file, returns false if it failed
+bool writePPM(const char *fileName, const ospcommon::vec2i &size,
               const uint32_t *pixel);
 } // namespace utils
\ No newline at end of file